@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# benchmark.sh -- reply candidates per second on a large synthetic brain.
+#
+# usage: ./benchmark.sh [lines [seconds [runs]]]
+#
+# A synthetic corpus of <lines> random sentences (Zipf-ish vocabulary) is
+# generated and trained once, into ./bench/megahal.brn. Then a reply is
+# generated <runs> times with a timeout of <seconds>, plain, with -H
+# (transparent huge pages) and with -F (a frozen brain), and the mean
+# ReplyProbed count is reported.
+# The brain is kept; remove ./bench to start over.
+#
+# Then the context walk microbenchmark (walk_driv.c) is built with and without
+# WANT_PREFETCH, and run over the corpus.
+#
+# Finally megahal is built with and without WANT_SORTED_CHILDREN, each build
+# trains its own brain, and the average number of children babble() steps
+# over per pick is reported.
+#
+LINES=${1:-100000}
+SECS=${2:-5}
+RUNS=${3:-3}
+DIR=./bench
+PROG=`pwd`/megahal
+
+[ -x $PROG ] || make megahal || exit 1
+mkdir -p $DIR
+
+if [ ! -f $DIR/megahal.brn ]; then
+	awk -v lines=$LINES 'BEGIN {
+		srand(42);
+		nvoc = 50000;
+		for (i = 0; i < nvoc; i++) {
+			w = ""; len = 2 + int(rand() * 8);
+			for (j = 0; j < len; j++) w = w sprintf("%c", 97 + int(rand() * 26));
+			voc[i] = w;
+			}
+		for (l = 0; l < lines; l++) {
+			len = 5 + int(rand() * 20); s = "";
+			for (j = 0; j < len; j++) s = s " " voc[int(nvoc * rand() ^ 3)];
+			print substr(s, 2) ".";
+			}
+		}' > $DIR/megahal.trn
+	echo "Training on $LINES lines ..."
+	( cd $DIR && $PROG -d . -q -p -b < /dev/null > /dev/null 2>&1 )
+fi
+ls -l $DIR/megahal.brn
+
+for opt in "" "-H" "-F"; do
+	tot=0
+	for run in `seq $RUNS`; do
+		cnt=`cd $DIR && echo "the quick brown fox" | $PROG -d . -p -b -t $SECS $opt 2>&1 >/dev/null \
+			| sed -n 's/.*ReplyProbed=\([0-9]*\).*/\1/p'`
+		tot=$((tot + ${cnt:-0}))
+	done
+	echo "megahal $opt: `expr $tot / $RUNS / $SECS` reply candidates/s (mean of $RUNS x ${SECS}s)"
+done
+
+for pf in 0 1; do
+	rm -f walkbench
+	make -s walkbench CFLAGS="${CFLAGS:--O2 -std=gnu99} -DWANT_PREFETCH=$pf" > /dev/null 2>&1 || exit 1
+	./walkbench $DIR < $DIR/megahal.trn 2> /dev/null
+done
+rm -f walkbench
+
+for sc in 0 1; do
+	SDIR=$DIR/sorted$sc
+	mkdir -p $SDIR && cp $DIR/megahal.trn $SDIR/ && rm -f $SDIR/megahal.brn $SDIR/megahal.txt
+	gcc ${CFLAGS:--O2 -std=gnu99} -DWANT_SORTED_CHILDREN=$sc -o $SDIR/megahal \
+		main.c megahal.c crosstab.c -lm > /dev/null 2>&1 || exit 1
+	( cd $SDIR && ./megahal -d . -q -p -b < /dev/null > /dev/null 2>&1 )
+	for run in `seq $RUNS`; do
+		( cd $SDIR && echo "the quick brown fox" | ./megahal -d . -p -b -t $SECS > /dev/null 2>&1 )
+	done
+	grep "^Babble Exit" $SDIR/megahal.txt | tr '{}=' '   ' | awk -v sc=$sc '
+		{ picks += $4; steps += $6 }
+		END { printf "WANT_SORTED_CHILDREN=%d picks=%d steps/pick=%.2f\n", sc, picks, steps / picks }'
+	rm -rf $SDIR
+done
@@ -305,7 +305,7 @@ ptr->table = malloc (newsize * sizeof *ptr->table);
 	/* we must first set the correct size, because crosstab_hnd() relies on it */
 ptr->msize = newsize;
 
-memcpy (ptr->table, oldrow, cpysize * sizeof *oldrow);
+if (cpysize) memcpy (ptr->table, oldrow, cpysize * sizeof *oldrow);
 row_format_slots( ptr->table , newsize );
 
 for (slot =0 ; slot < cpysize; slot++) {
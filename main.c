@@ -44,6 +44,8 @@ extern bool typing_delay;
 extern bool speech;
 */
 int myquiet=0;
+int myrelayout=0;
+int mycompact=0;
  
 static struct option long_options[] = {
     {"no-prompt", 0, NULL, 'p'},
@@ -51,12 +53,16 @@ static struct option long_options[] = {
     {"no-banner", 0, NULL, 'b'},
     {"help", 0, NULL, 'h'},
     {"directory", 1, NULL, 'd'},
+    {"huge-pages", 0, NULL, 'H'},
+    {"frozen", 0, NULL, 'F'},
+    {"relayout", 0, NULL, 'R'},
+    {"compact", 0, NULL, 'C'},
     {0, 0, 0, 0}
 };
 
 void usage()
 {
-    puts("usage: megahal [-[pqrgwbh]]\n" \
+    puts("usage: megahal [-[pqrgwbhHFRC]]\n" \
 	 "\t-h : show usage\n" \
 	 "\t-p --no-prompt:  inhibit prompts\n" \
 	 "\t-q : quiet mode (no replies) enabled at start\n" \
@@ -64,6 +70,10 @@ void usage()
 	 "\t-g : inhibit initial greeting\n" \
 	 "\t-b --no-banner: inhibit banner display at startup\n" \
 	 "\t-t -value: set timeout to value\n" \
+	 "\t-H --huge-pages: back the brain with transparent huge pages\n" \
+	 "\t-F --frozen: serve from a compact, read-only copy of the brain\n" \
+	 "\t-R --relayout: pack the brain's nodes in depth-first order after loading or training\n" \
+	 "\t-C --compact: drop the unused words, and renumber the rest by frequency\n" \
          "\t-d : sets the directory where your megahal files are\n");
 }
 
@@ -88,7 +98,7 @@ int main(int argc, char **argv)
     directory_set = 0;
 
     while(1) {
-	if((c = getopt_long(argc, argv, "hpqrgbd:t:", long_options,
+	if((c = getopt_long(argc, argv, "hpqrgbHFRCd:t:", long_options,
 			    &option_index)) == -1)
 	    break;
 	switch(c) {
@@ -112,6 +122,18 @@ int main(int argc, char **argv)
 	case 'b':
 	    megahal_setnobanner();
 	    break;
+	case 'H':
+	    megahal_sethugepages();
+	    break;
+	case 'F':
+	    megahal_setfrozen();
+	    break;
+	case 'R':
+	    myrelayout = 1;
+	    break;
+	case 'C':
+	    mycompact = 1;
+	    break;
 	case 'h':
 	    usage();
 	    return 0;
@@ -170,6 +192,8 @@ int main(int argc, char **argv)
      *		Do some initialisation 
      */
     megahal_initialize();
+    if (mycompact) megahal_compact();
+    if (myrelayout) megahal_relayout();
 
     /*
      *		Read input, formulate a reply and display it as output
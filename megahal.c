@@ -266,11 +266,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h> /* offsetof */
 
 #pragma define _BSD_SOURCE 1
 #pragma define _XOPEN_SOURCE 1
+#include <stdint.h> /* intptr_t: unistd.h declares sbrk() under __USE_MISC */
 #define __USE_MISC
 #include <unistd.h>    // lockf()
+#include <sys/mman.h> /* mmap(), madvise(), MADV_HUGEPAGE */
 #undef __USE_MISC
 
 #include <getopt.h>
@@ -288,6 +291,7 @@ extern char *strdup(const char *);
 #include <time.h>
 
 #include <sys/types.h>
+#include <sys/stat.h> /* fstat() */
 
 #include "megahal.h"
 
@@ -323,6 +327,93 @@ extern char *strdup(const char *);
 	*/
 #define WANT_STORE_HASH 0
 
+	/* The dict's index. WANT_FAST_DICT=1: open addressing in a power-of-two table, at most
+	** half full, with linear probing. The table is separate from the dictslots, and holds
+	** (hash, symbol) pairs: a probe only reads the index, and the word is only compared
+	** when the full hash matches. The words are hashed 8 bytes at a time.
+	** WANT_FAST_DICT=0: the old tabl/link chains in the dictslots, and a bytewise hash.
+	*/
+#ifndef WANT_FAST_DICT
+#define WANT_FAST_DICT 1
+#endif
+
+	/* Every dictslot knows the symbol of its all-lowercase variant (->canon), so the
+	** keyword and penalty code need not lowercase a word and look it up again.
+	** The words that have the same lowercase form are linked in a ring (->fold).
+	** A second index, on the hash of the lowercase form, finds a ring for a new word.
+	*/
+#ifndef WANT_CASE_FOLD
+#define WANT_CASE_FOLD 1
+#endif
+
+	/* symbol_weight() results are cached per symbol (and want_other). The dict has an
+	** epoch, which every change to a word or a count bumps; a cached weight is only
+	** valid in the epoch it was computed in. While replies are generated nothing
+	** changes, and the weights are computed once.
+	*/
+#ifndef WANT_WEIGHT_CACHE
+#define WANT_WEIGHT_CACHE 1
+#endif
+
+	/* Token garbage collection. Words are never deleted from the dict, not even when
+	** Alzheimer has removed the last node that referred to them.
+	** model_compact() keeps only the words that still occur in the trees (and <ERROR>
+	** and <FIN>), numbers them densely and rewrites the symbols
+	** in both trees. save_model() does this whenever at least DICT_GC_PERCENT of the
+	** words are garbage; megahal_compact() (main.c: -C) does it unconditionally.
+	*/
+#ifndef WANT_DICT_GC
+#define WANT_DICT_GC 1
+#endif
+#ifndef DICT_GC_PERCENT
+#define DICT_GC_PERCENT 10
+#endif
+
+	/* Frequency order. model_compact() also renumbers the words by descending valuesum
+	** (after <ERROR> and <FIN>), so the frequent words get the small symbols: their dict
+	** slots and the entries of the symbol-indexed tables (dense roots, weight cache)
+	** share cache lines. An explicit compact always sorts. On save, it only sorts
+	** when at least DICT_SORT_PERCENT% of the hot words (the DICT_SORT_HOT most
+	** frequent ones, or a quarter of the dict if that is less) have a symbol outside
+	** the hot range: a few newcomers do not pay for renumbering both trees on every
+	** save. (if it compacts anyway, it also sorts)
+	*/
+#ifndef WANT_DICT_SORT
+#define WANT_DICT_SORT 1
+#endif
+#ifndef DICT_SORT_HOT
+#define DICT_SORT_HOT 4096
+#endif
+#ifndef DICT_SORT_PERCENT
+#define DICT_SORT_PERCENT 10
+#endif
+#if !WANT_DICT_GC
+#undef WANT_DICT_SORT
+#define WANT_DICT_SORT 0
+#endif
+
+	/* A minimal perfect hash over the dict of a frozen brain, which never changes.
+	** The words are spread over buckets (MPH_BUCKET_LOAD per bucket, on average) by
+	** their 64-bit hash, and every bucket gets a pilot: the first number that, mixed
+	** into the hash, sends all of its words to slots that are still free. (the biggest
+	** buckets go first) There are exactly as many slots as words.
+	** find_word() then is one hash, one pilot, one slot and one compare with the word
+	** in that slot; if that is another word, the word is unknown.
+	** The pilots are kept in megahal.mph, next to the brain. A file that does not map
+	** the current words one-to-one is ignored, and rewritten. Adding a word drops the MPH.
+	*/
+#ifndef WANT_DICT_MPH
+#define WANT_DICT_MPH 1
+#endif
+#if !WANT_FAST_DICT
+	/* (it needs the 64-bit hash) */
+#undef WANT_DICT_MPH
+#define WANT_DICT_MPH 0
+#endif
+#define MPH_BUCKET_LOAD 4
+#define MPH_PILOT_MAX 0x1000000
+#define MPH_COOKIE "WakkerMPH0"
+
 	/* some develop/debug switches. 0 to disable */
 #define WANT_DUMP_REHASH_TREE 0
 #define WANT_DUMP_DELETE_DICT 0
@@ -404,6 +495,13 @@ typedef unsigned int DictSize;
 typedef unsigned int Count;
 typedef unsigned int UsageCnt;
 typedef unsigned int HashVal;
+	/* A word's hash as carried in a sentence: with the fast dict it is the full
+	** 64 bit hash, of which the dict's index uses the low half, and the MPH all of it */
+#if WANT_FAST_DICT
+typedef unsigned long long WordHash;
+#else
+typedef HashVal WordHash;
+#endif
 typedef unsigned int Stamp;
 typedef unsigned long long BigThing;
 typedef unsigned long long UsageSum;
@@ -424,8 +522,10 @@ typedef struct {
 } STRING;
 
 struct	dictslot {
+#if !WANT_FAST_DICT
 	WordNum tabl;
 	WordNum link;
+#endif
 #if WANT_STORE_HASH
 	HashVal whash;
 #endif /* WANT_STORE_HASH */
@@ -434,6 +534,30 @@ struct	dictslot {
 		UsageCnt valuesum;
 		} stats;
 	STRING string;
+#if WANT_CASE_FOLD
+	WordNum canon;	/* the all-lowercase variant; WORD_NIL: there is none */
+	WordNum fold;	/* the next word with the same lowercase form */
+#endif
+	};
+
+	/* An open addressed index on a hash of the words: see WANT_FAST_DICT */
+struct dictindex {
+	HashVal hash;
+	WordNum symbol;	/* WORD_NIL: free */
+	};
+
+	/* The words' bytes live in blocks owned by their dict. A block is only appended to,
+	** so a STRING that points into it stays valid until the dict is emptied.
+	** The dict of a brainfile is read as one blob, which becomes one block. */
+#ifndef WANT_STRING_ARENA
+#define WANT_STRING_ARENA 1
+#endif
+#define STRING_BLOCK_SIZE 65536
+struct strblock {
+	struct strblock *next;
+	size_t used;
+	size_t size;
+	char data[];
 	};
 
 typedef struct {
@@ -445,64 +569,431 @@ typedef struct {
 		DictSize nonzero;
 		} stats;
     struct dictslot *entry;
+#if WANT_FAST_DICT
+    unsigned hbits;	/* the index has 1<<hbits slots */
+    struct dictindex *index;
+#endif
+#if WANT_CASE_FOLD
+    unsigned fbits;
+    struct dictindex *foldindex;	/* on the lowercase form: one word of each ring */
+#endif
+#if WANT_STRING_ARENA
+    struct strblock *arena;	/* the newest block first */
+#endif
+#if WANT_DICT_MPH
+    struct dictmph {
+	DictSize msize;	/* the number of words, and of slots */
+	unsigned nbucket;
+	unsigned *pilot;	/* [nbucket] */
+	WordNum *slot;	/* [msize] */
+	} *mph;
+#endif
+#if WANT_WEIGHT_CACHE
+    unsigned long epoch;
+    DictSize wsize;
+    struct wordweight {
+	double value[2];	/* [want_other] */
+	unsigned long epoch[2];
+	} *weight;
+#endif
 } DICT;
 
-	/* We use SQRT(1+n) as the value to increment/decrement with.
+	/* The dict grows by DICT_GROW_PERCENT of its used size. (it used to be SQRT(1+n),
+	** which rehashes every word O(SQRT(n)) times)
 	** NOTE dicts will hardly ever be shrunk; only emptied.
 	*/
 #define DICT_SIZE_INITIAL 4
 #define DICT_SIZE_SHRINK 16
+#ifndef DICT_GROW_PERCENT
+#define DICT_GROW_PERCENT 50
+#endif
 
+	/* Two node engines are available:
+	** WANT_OLD_NODES=1: every node owns a (pooled) array of child slots, hashed on symbol.
+	** WANT_OLD_NODES=0: the "flat" engine. All nodes live in one node table and refer
+	**	to each other by 32-bit number. Children are found via one global hash
+	**	on (parent,symbol), and enumerated via a sibling list. No per-node child arrays.
+	** The brainfile format is the same for both.
+	*/
+#ifndef WANT_OLD_NODES
 #define WANT_OLD_NODES 1
+#endif
+
+	/* Shared grams (flat engine only). Every n-gram is counted in both trees, in mirrored
+	** order: the forward node for "a b c" and the backward node for "c b a" get the same
+	** count. With WANT_SHARED_GRAMS=1 the two nodes live in one record (struct gram),
+	** which holds the count and the stamp once. A new backward node looks up its forward
+	** twin, and joins it only when their counts agree: when both were created for the
+	** same sentence, or loaded with the same count. From then on the forward pass does the
+	** counting for both. Nodes without a twin (the <FIN> grams, and whatever Alzheimer
+	** split up) count for themselves, so all counts come out the same as without it.
+	** The stamp of a pair is the later of the two.
+	*/
+#ifndef WANT_SHARED_GRAMS
+#define WANT_SHARED_GRAMS 0
+#endif
+#if WANT_OLD_NODES
+#undef WANT_SHARED_GRAMS
+#define WANT_SHARED_GRAMS 0
+#endif
+
+	/* Suffix ("vine") links. Every node can point to the node for the same context
+	** minus its oldest word. (in the same tree)
+	** update_context() and update_model() only need a lookup at the deepest order,
+	** the lower orders are found by following the links.
+	** Links are not stored in the brainfile; they are filled in lazily, whenever
+	** a lookup has been done anyway. Alzheimer resets them.
+	*/
+#ifndef WANT_SUFFIX_LINKS
+#define WANT_SUFFIX_LINKS 1
+#endif
+
 #if WANT_OLD_NODES
+	/* Nodes with at most NODE_INLINE_MAX children keep them inline, in the space
+	** that would otherwise hold the children pointer. (msize == 0 indicates this)
+	** They are spilled into a hashed child array when they grow beyond that.
+	** Most nodes have zero or one children, so 1 costs nothing extra.
+	*/
+#ifndef NODE_INLINE_MAX
+#define NODE_INLINE_MAX 1
+#endif
+
+	/* Keep the children of every node sorted by descending count, so the weighted
+	** pick in babble() can stop after a few children. add_symbol_node() moves a child
+	** forward when it overtakes its predecessor, deleting a child shifts the ones
+	** after it, and load_tree() sorts nodes that were saved unsorted.
+	** Without it, resize_tree() does one bubble pass whenever a node grows.
+	*/
+#ifndef WANT_SORTED_CHILDREN
+#define WANT_SORTED_CHILDREN 1
+#endif
+
+	/* When babble() picks from a node with at least SAMPLER_FANOUT children, it
+	** builds a sampler for it: the running sums of the children's counts. The weighted
+	** pick then is a binary search, instead of a walk over (up to) all the children,
+	** and it finds the same child. Samplers live in a direct mapped cache
+	** (SAMPLER_SLOTS entries, keyed by node) and are dropped whenever their node is
+	** changed or freed. Replies are generated without changing the tree, so they
+	** survive a whole reply cycle. Most big nodes are only visited once in a while:
+	** the first pick from a node just claims its slot, the second one builds.
+	*/
+#ifndef WANT_SAMPLERS
+#define WANT_SAMPLERS 1
+#endif
+#ifndef SAMPLER_FANOUT
+#define SAMPLER_FANOUT 32
+#endif
+#ifndef SAMPLER_BITS
+#define SAMPLER_BITS 12
+#endif
+#define SAMPLER_SLOTS (1u << SAMPLER_BITS)
+#define SAMPLER_HASH(node) ((((unsigned) ((size_t) (node) / sizeof (TREE))) * 0x9e3779b1u) >> (32 - SAMPLER_BITS))
+
+	/* Bigger nodes have a child table: a block of msize (a power of two) entries,
+	** stored as three consecutive arrays:
+	**	TREE *children[msize]	the children, dense: 0...branch-1
+	**	WordNum hsym[msize]	open addressing hash on symbol; WORD_NIL marks an empty bucket
+	**	ChildIndex hidx[msize]	for every bucket: the index into children[]
+	** The symbols are contiguous, so a probe does not touch the child nodes.
+	** The load factor is kept at or below CHILD_LOAD_PERCENT. (it must stay below 100)
+	** A table that gets too full grows by a factor 1<<CHILD_GROW_SHIFT, so every
+	** child is rehashed O(1) times on average. Bigger factors mean fewer rehashes,
+	** but more empty buckets. (see the "Slack" memstat)
+	** It is shrunk when less than 1/(2<<CHILD_GROW_SHIFT) full.
+	** struct treeslot only serves to describe the size of one entry.
+	*/
+#ifndef CHILD_LOAD_PERCENT
+#define CHILD_LOAD_PERCENT 75
+#endif
+#ifndef CHILD_GROW_SHIFT
+#define CHILD_GROW_SHIFT 1
+#endif
 struct treeslot {
-    ChildIndex tabl;
-    ChildIndex link;
     struct treenode *ptr;
+    WordNum hsym;
+    ChildIndex hidx;
+	};
+#define CHILD_HSYM(node) ((WordNum *) ((node)->u.children + NODE_MSIZE(node)))
+#define CHILD_HIDX(node) ((ChildIndex *) (CHILD_HSYM(node) + NODE_MSIZE(node)))
+#define CHILD_HASH(symbol) (((symbol) * 0x9e3779b1u) ^ (((symbol) * 0x9e3779b1u) >> 16))
+
+	/* The roots of the forward and backward trees have a child for (almost) every token.
+	** They get a dense index instead of a hash table: sidx[symbol] is the index
+	** of that symbol's child in children[], or CHILD_NIL.
+	** WordNums are stable, so lookup is a single load, and adding a child is an append.
+	** msize == CHILD_DENSE indicates this; ->u.children points into the struct rootindex.
+	*/
+#ifndef WANT_DENSE_ROOT
+#define WANT_DENSE_ROOT 1
+#endif
+#define CHILD_DENSE ((ChildIndex)-2)
+#define ROOT_SIZE_INITIAL 256
+struct rootindex {
+    WordNum ssize;	/* size of sidx[] */
+    ChildIndex csize;	/* size of children[] */
+    ChildIndex *sidx;
+    struct treenode *children[];
 	};
+#define ROOT_INDEX(node) ((struct rootindex *) ((char *) (node)->u.children - offsetof(struct rootindex, children)))
+
+	/* Path compression.
+	** Most of the tree consists of sentences that were seen only once: chains of
+	** nodes with thevalue == 1 and (at most) one child, all with the same stamp.
+	** Such a chain is stored as a "run" in the node above it: msize == CHILD_RUN(length)
+	** and ->u.run points to {symbol[length], stamp}, allocated from the slot pool.
+	** The run's nodes are implied: thevalue=1, childsum=branch=1 (0 for the last one).
+	** Lookups that only read get a "view": a scratch node that points into the
+	** run's tail (find_symbol_view()). Lookups that modify split off the first node.
+	** (node_unrun()) Runs are built when loading, after training, and by Alzheimer.
+	*/
+#ifndef WANT_PATH_COMPRESSION
+#define WANT_PATH_COMPRESSION 1
+#endif
+#define RUN_LEN_MAX 0xffff
+#define CHILD_RUN(len) ((ChildIndex)-4 - (len))
+#define NODE_IS_RUN(node) ((node)->msize >= CHILD_RUN(RUN_LEN_MAX) && (node)->msize <= CHILD_RUN(1))
+#define RUN_LEN(node) ((ChildIndex)-4 - (node)->msize)
+#define RUN_SYM(node,idx) ((node)->u.run[idx])
+#define RUN_STAMP(node) ((node)->u.run[RUN_LEN(node)])
+#define RUN_PER_SLOT (sizeof (struct treeslot) / sizeof (WordNum))
+#define RUN_NSLOT(len) ((1 + (len) + RUN_PER_SLOT-1) / RUN_PER_SLOT)
+
+	/* Frozen brains, for read-only serving replicas.
+	** With frozen set (megahal_setfrozen(), or -F) load_model() compiles the trees in
+	** the brain file into an immutable, succinct form. No TREEs are built at all.
+	** - The shape of both trees is one LOUDS bit vector. The nodes are numbered level
+	**   by level (the forward and backward roots are 0 and 1), and every node adds
+	**   a 1 per child, followed by a 0. A node's children are consecutive: they start
+	**   at 2 + the number of 1s before its block, which louds_select0() finds.
+	** - Per level, one bit-packed record per node holds the symbol, the running sum of
+	**   the counts within its group of siblings and the stamp (relative to stamp_min),
+	**   each field just wide enough for that level. A count is the difference with the
+	**   left sibling's sum, a childsum is the last child's sum, and babble() does a
+	**   binary search.
+	** - Siblings are sorted by symbol, so lookups are a binary search, too.
+	** The reply code sees frozen nodes through views, like the nodes inside a run:
+	** msize == CHILD_FROZEN, and ->u.fnum is the number of the first child.
+	** Learning, Alzheimer, relayout and saving are disabled.
+	*/
+#ifndef WANT_FROZEN
+#define WANT_FROZEN 1
+#endif
+#if !WANT_PATH_COMPRESSION
+	/* frozen nodes are only seen through views */
+#undef WANT_FROZEN
+#define WANT_FROZEN 0
+#endif
+#define CHILD_FROZEN ((ChildIndex)-3)
+#define FROZEN_LEVEL_MAX 64
+#define LOUDS_BLOCK 4	/* 64-bit words per rank0[] entry */
+#define LOUDS_SAMPLE 64	/* 0s per select0[] entry */
+#define FROZEN_SYM(lev,idx) bits_get((lev)->bits, (unsigned long long)(idx) * (lev)->width, (lev)->wsym)
+#define FROZEN_CUM(lev,idx) bits_get((lev)->bits, (unsigned long long)(idx) * (lev)->width + (lev)->wsym, (lev)->wcum)
+#define FROZEN_STAMP(lev,idx) bits_get((lev)->bits \
+	, (unsigned long long)(idx) * (lev)->width + (lev)->wsym + (lev)->wcum, (lev)->wstamp)
+#define LOUDS_BIT(pos) ((frozen_brain.louds[(pos) / 64] >> ((pos) % 64)) & 1)
+	/* (without -mpopcnt, __builtin_popcountll() is a library call) */
+#if defined(__GNUC__) && defined(__POPCNT__)
+#define POPCOUNT64(word) __builtin_popcountll(word)
+#else
+#define POPCOUNT64(word) popcount64(word)
+#endif
+#ifdef __GNUC__
+#define CTZ64(word) __builtin_ctzll(word)
+#else
+#define CTZ64(word) POPCOUNT64(((word) & -(word)) - 1)
+#endif
+
+	/* Compact nodes.
+	** Nearly all nodes have small counts, so thevalue and childsum are stored in 16 bits.
+	** The stamp is stored as a 16-bit epoch, relative to stamp_base.
+	** msize is encoded in one byte: 0 for inline, log2(msize) for a child table,
+	** MCODE_DENSE for a dense root, MCODE_FROZEN for a frozen view,
+	** or MCODE_RUN with the run's length in rlen.
+	** A value that does not fit is replaced by the escape COUNT_WIDE (or EPOCH_WIDE),
+	** and the real value is kept in the wide table, hashed on the node's address.
+	** All access goes via the NODE_xxx() macros below; they are plain field access
+	** if compact nodes are disabled.
+	** stamp_rebase() moves stamp_base up (and re-encodes all stamps) when stamp_min
+	** has advanced, or when stamp_max is about to run out of the epoch range.
+	*/
+#ifndef WANT_COMPACT_NODES
+#define WANT_COMPACT_NODES 1
+#endif
+#if WANT_COMPACT_NODES
+#undef RUN_LEN_MAX
+#define RUN_LEN_MAX 0xff
+#undef NODE_IS_RUN
+#define NODE_IS_RUN(node) ((node)->mcode == MCODE_RUN)
+#undef RUN_LEN
+#define RUN_LEN(node) ((ChildIndex)(node)->rlen)
+#define COUNT_WIDE 0xffff
+#define EPOCH_WIDE 0xffff
+#define EPOCH_HEADROOM 0x1000
+#define MCODE_FROZEN 0xfd
+#define MCODE_DENSE 0xfe
+#define MCODE_RUN 0xff
+#endif
 
 typedef struct treenode {
+#if WANT_COMPACT_NODES
+    WordNum symbol;
+    unsigned short stamp;	/* epoch: relative to stamp_base */
+    unsigned short thevalue; /* my count */
+    unsigned short childsum; /* sum of children's count */
+    unsigned char mcode;	/* encoded msize */
+    unsigned char rlen;	/* length of the run, for MCODE_RUN */
+    ChildIndex branch;
+#else
     UsageCnt childsum; /* sum of children's count */
     UsageCnt thevalue; /* my count */
     WordNum symbol;
     Stamp stamp;
     ChildIndex msize;
     ChildIndex branch;
-    struct treeslot *children;
+#endif
+#if WANT_SUFFIX_LINKS
+    struct treenode *suffix;
+#endif
+    union {
+	struct treenode **children;	/* msize > 0 */
+	struct treenode *kids[NODE_INLINE_MAX];	/* msize == 0 */
+	WordNum *run;	/* msize == CHILD_RUN(len) */
+	unsigned long fnum;	/* msize == CHILD_FROZEN: the first child's number */
+	} u;
 } TREE;
+
+#if WANT_COMPACT_NODES
+	/* Wide table entry. Only the escaped fields are valid. */
+struct nodewide {
+    TREE *node;
+    UsageCnt childsum;
+    UsageCnt thevalue;
+    Stamp stamp;
+	};
+#define NODE_VALUE(node) ((node)->thevalue != COUNT_WIDE ? (UsageCnt)(node)->thevalue : node_wide_find(node)->thevalue)
+#define NODE_CHILDSUM(node) ((node)->childsum != COUNT_WIDE ? (UsageCnt)(node)->childsum : node_wide_find(node)->childsum)
+#define NODE_STAMP(node) ((node)->stamp != EPOCH_WIDE ? (Stamp)(stamp_base + (node)->stamp) : node_wide_find(node)->stamp)
+#define NODE_SET_VALUE(node,val) node_set_value((node), (val))
+#define NODE_SET_CHILDSUM(node,val) node_set_childsum((node), (val))
+#define NODE_SET_STAMP(node,val) node_set_stamp((node), (val), stamp_base)
+#define NODE_MSIZE(node) (!(node)->mcode ? 0 : (node)->mcode < MCODE_FROZEN ? (ChildIndex)1 << (node)->mcode \
+	: (node)->mcode == MCODE_DENSE ? CHILD_DENSE : (node)->mcode == MCODE_FROZEN ? CHILD_FROZEN \
+	: CHILD_RUN((node)->rlen))
+#define NODE_SET_MSIZE(node,val) node_set_msize((node), (val))
+#define NODE_IS_INLINE(node) (!(node)->mcode)
+#define NODE_IS_DENSE(node) ((node)->mcode == MCODE_DENSE)
+#define NODE_IS_FROZEN(node) ((node)->mcode == MCODE_FROZEN)
+#else
+#define NODE_MSIZE(node) ((node)->msize)
+#define NODE_SET_MSIZE(node,val) ((node)->msize = (val))
+#define NODE_IS_INLINE(node) (!(node)->msize)
+#define NODE_IS_DENSE(node) ((node)->msize == CHILD_DENSE)
+#define NODE_IS_FROZEN(node) ((node)->msize == CHILD_FROZEN)
+#endif
+
+	/* Child enumeration. A cursor is an index into ->u.children[] or ->u.kids[] */
+#define CHILD_FIRST(node) ((node)->branch ? 0 : CHILD_NIL)
+#define CHILD_NEXT(node,cidx) ((cidx)+1 < (node)->branch ? (cidx)+1 : CHILD_NIL)
+#define CHILD_PTR(node,cidx) (!NODE_IS_INLINE(node) ? (node)->u.children[cidx] : (node)->u.kids[cidx])
+	/* Enumeration that survives deletion of the current child.
+	** del_symbol_do_free() moves the top slot (or all the slots above it)
+	** into the vacated one, so we have to work from top to bottom. */
+#define CHILD_REAP_FIRST(node) ((node)->branch ? (node)->branch-1 : CHILD_NIL)
+#define CHILD_REAP_NEXT(node,cidx) ((cidx) ? (cidx)-1 : CHILD_NIL)
 #else
-typedef unsigned NodeNum, NodeIdx;
+typedef unsigned NodeNum;
 #define NODE_NUM_NIL ((NodeNum) -1)
-#define NODE_IDX_NIL ((NodeIdx) -1)
-struct nnode {
-	struct hnode {
-		NodeIdx head,link;
-		} num,partok, par;
-	NodeNum num,pnum; /* persistant number + parent number */
-	WordNum tok;
-	Stamp stamp;
-	UsageCnt childsum;
-	UsageCnt thevalue;
-	UsageCnt maxvalue;
-	};
+
+typedef struct treenode {
+    UsageCnt childsum; /* sum of children's count */
+#if !WANT_SHARED_GRAMS
+    UsageCnt thevalue; /* my count */
+#endif
+    WordNum symbol;
+#if !WANT_SHARED_GRAMS
+    Stamp stamp;
+#endif
+    ChildIndex branch;
+    NodeNum num;	/* my own number; NODE_NUM_NIL if on the freelist */
+    NodeNum parent;
+    NodeNum link;	/* hash chain for (parent,symbol) */
+    NodeNum kids;	/* first child */
+    NodeNum next;	/* next sibling (or next free node) */
+#if WANT_SUFFIX_LINKS
+    struct treenode *suffix;
+#endif
+} TREE;
+
+#if WANT_SHARED_GRAMS
+	/* The two halves of an n-gram: [0] is the forward node, [1] the backward one.
+	** A node's number is twice its gram's number, plus its half.
+	** A half that is not in use has num == NODE_NUM_NIL. */
+struct gram {
+    UsageCnt thevalue;
+    Stamp stamp;
+    TREE half[2];
+};
+#define GRAM_HALF(node) ((node)->num & 1)
+#define NODE_GRAM(node) ((struct gram *) ((char *) ((node) - GRAM_HALF(node)) - offsetof(struct gram, half)))
+#define NODE_TWIN(node) (GRAM_HALF(node) ? (node) - 1 : (node) + 1)
+#endif
+
+	/* Child enumeration. A cursor is the child's NodeNum.
+	** (NODE_NUM_NIL and CHILD_NIL are the same value) */
+#define CHILD_FIRST(node) ((node)->kids)
+#define CHILD_NEXT(node,cidx) (NODE_PTR(cidx)->next)
+#define CHILD_PTR(node,cidx) NODE_PTR(cidx)
+	/* the caller must fetch the next cursor *before* deleting the current child */
+#define CHILD_REAP_FIRST(node) CHILD_FIRST(node)
+#define CHILD_REAP_NEXT(node,cidx) CHILD_NEXT(node,cidx)
+	/* No path compression (yet) for the flat engine */
+#undef WANT_PATH_COMPRESSION
+#define WANT_PATH_COMPRESSION 0
+	/* nor compact nodes */
+#undef WANT_COMPACT_NODES
+#define WANT_COMPACT_NODES 0
+	/* nor sorted children: they are in a sibling list */
+#undef WANT_SORTED_CHILDREN
+#define WANT_SORTED_CHILDREN 0
+	/* nor samplers: they need child indices */
+#undef WANT_SAMPLERS
+#define WANT_SAMPLERS 0
+	/* nor frozen brains: they are seen through views */
+#undef WANT_FROZEN
+#define WANT_FROZEN 0
+#endif
+#if !WANT_FROZEN
+#undef NODE_IS_FROZEN
+#define NODE_IS_FROZEN(node) 0
+#endif
+
+#if WANT_SHARED_GRAMS
+#define NODE_VALUE(node) (NODE_GRAM(node)->thevalue)
+#define NODE_CHILDSUM(node) ((node)->childsum)
+#define NODE_STAMP(node) (NODE_GRAM(node)->stamp)
+#define NODE_SET_VALUE(node,val) (NODE_GRAM(node)->thevalue = (val))
+#define NODE_SET_CHILDSUM(node,val) ((node)->childsum = (val))
+#define NODE_SET_STAMP(node,val) (NODE_GRAM(node)->stamp = (val))
+#elif !WANT_COMPACT_NODES
+#define NODE_VALUE(node) ((node)->thevalue)
+#define NODE_CHILDSUM(node) ((node)->childsum)
+#define NODE_STAMP(node) ((node)->stamp)
+#define NODE_SET_VALUE(node,val) ((node)->thevalue = (val))
+#define NODE_SET_CHILDSUM(node,val) ((node)->childsum = (val))
+#define NODE_SET_STAMP(node,val) ((node)->stamp = (val))
 #endif
 
-#if WANT_OLD_NODES
 typedef struct {
     Count order;
     TREE *forward;
     TREE *backward;
     TREE **context;
+#if WANT_PATH_COMPRESSION
+    TREE *view;	/* scratch nodes for find_symbol_view(), one per context level */
+#endif
     DICT *dict;
 } MODEL;
-#else
-typedef struct {
-    Count order;
-    NodeNum fwd,rev;
-    NodeNum context[10];
-    DICT *dict;
-} MODEL;
-#endif
 
 struct memstat {
 	unsigned word_cnt;
@@ -515,6 +1006,83 @@ struct memstat {
         unsigned long long tokens_read;
 	} volatile memstats = {0,0,0,0,0,0,0,0} ;
 
+	/* The CPU side of the growth policy: how often child tables and the dict
+	** were (re)allocated, and how many entries were rehashed doing so.
+	** The memory side (slack) is counted by show_memstat().
+	*/
+static struct growstats {
+	unsigned long child_resize;
+	unsigned long long child_moved;
+	unsigned long dict_resize;
+	unsigned long long dict_moved;
+	} grow_stats = {0, 0, 0, 0};
+
+	/* babble()'s weighted picks: how many, and how many children they stepped over */
+static struct babblestats {
+	unsigned long npick;
+	unsigned long long nstep;
+	unsigned long nsample;	/* picks done by a sampler (not counted in nstep) */
+	} babble_stats = {0, 0, 0};
+
+#if WANT_WEIGHT_CACHE
+static struct weightstats {
+	unsigned long long nask;
+	unsigned long ncalc;
+	} weight_stats = {0, 0};
+#endif
+
+#if WANT_SAMPLERS
+static struct samplercache {
+	struct sampler {
+		TREE *node;
+		ChildIndex branch;
+		UsageCnt *sum;	/* sum[i]: the counts of children 0...i added up */
+		} slot[SAMPLER_SLOTS];
+	unsigned long nbuild;
+	unsigned long ndrop;
+	unsigned long long bytes;
+	} sampler_cache;
+#endif
+
+#if WANT_FROZEN
+static struct frozenbrain {
+	unsigned long nnode;
+	unsigned nlevel;
+	unsigned long lstart[FROZEN_LEVEL_MAX+1];	/* level l: nodes lstart[l] ... lstart[l+1]-1 */
+	struct frozenlevel {
+		unsigned long long *bits;	/* a record per node: symbol, cum, stamp */
+		unsigned width;	/* of a record: the sum of the fields' widths */
+		unsigned wsym;
+		unsigned wcum;	/* running sum of the counts, per group of siblings */
+		unsigned wstamp;	/* relative to stamp_lo */
+		} level[FROZEN_LEVEL_MAX];
+	Stamp stamp_lo;
+	unsigned long long *louds;
+	unsigned long nbit;
+	unsigned *rank0;	/* rank0[b]: the number of 0s before block b (LOUDS_BLOCK words) */
+	unsigned long nblock;
+	unsigned *select0;	/* select0[k]: the position of 0 number k*LOUDS_SAMPLE */
+	unsigned long nsample;
+	unsigned long long bytes;
+	TREE root[2];	/* views of the roots: model->forward and model->backward */
+	unsigned *rootkid[2];	/* like the dense roots: symbol -> 1 + the child's index in level 1 */
+	WordNum nrootkid;
+	} frozen_brain;
+
+	/* One level of a frozen brain being compiled: its nodes, in file order */
+struct frozenrec {
+	WordNum symbol;
+	UsageCnt thevalue;
+	Stamp stamp;
+	ChildIndex branch;
+	};
+struct frozenbuild {
+	struct frozenrec *rec;
+	unsigned long mused;
+	unsigned long msize;
+	};
+#endif
+
 /*===========================================================================*/
 static char *errorfilename = "megahal.log";
 static char *statusfilename = "megahal.txt";
@@ -528,6 +1096,8 @@ static int noprogress = 0;
 static int nowrap = 0;
 static int nobanner = 0;
 static int quiet = 0;
+static int hugepages = 0;
+static int frozen = 0;
 static FILE *errorfp;
 static FILE *statusfp;
 
@@ -551,6 +1121,18 @@ static char *glob_directory = NULL;
 static char *last_directory = NULL;
 
 static Stamp stamp_min = 0, stamp_max=0;
+#if WANT_COMPACT_NODES
+static Stamp stamp_base = 0;
+
+	/* The wide table: open addressing, linear probing, on the node's address */
+static struct nodewidetable {
+	unsigned msize;	/* a power of two, or zero */
+	unsigned mused;
+	struct nodewide *slots;
+	} node_wide = {0, 0, NULL};
+#define WIDE_SIZE_INITIAL 64
+#define WIDE_HASH(node) ((unsigned)(((size_t)(node) / sizeof (TREE)) * 0x9e3779b1u))
+#endif
 
 volatile sig_atomic_t signal_caught = 0;
 
@@ -558,11 +1140,169 @@ volatile sig_atomic_t signal_caught = 0;
 #define ALZHEIMER_NODE_COUNT (16*1024*1024)
 #endif
 #define NODE_COUNT (ALZHEIMER_NODE_COUNT+(2*1024*1024))
+#if WANT_OLD_NODES
 struct treenode nodes[NODE_COUNT];
 
-STATIC int resize_tree(TREE *tree, unsigned newsize);
+	/* Node pool.
+	** Nodes are carved out of big slabs instead of being malloc()d one by one.
+	** The static nodes[] array is the first slab; when it is exhausted
+	** additional slabs of NODE_SLAB_SIZE nodes are malloc()d. Slabs are never returned.
+	** Freed nodes go onto an intrusive freelist, and are recycled first.
+	** The malloc()d slabs are remembered in extra[], so model_relayout() can
+	** empty the pool and refill it from the start.
+	*/
+#define NODE_SLAB_SIZE (1024*1024)
+union nodefree {
+	union nodefree *next;
+	struct treenode node;
+	};
+
+static struct nodepool {
+	struct treenode *slab;	/* current slab */
+	unsigned mused;
+	unsigned msize;
+	unsigned nslab;
+	unsigned long nfree;	/* items on the freelist */
+	unsigned long ninuse;
+	union nodefree *freelist;
+	struct treenode **extra;	/* the malloc()d slabs */
+	unsigned nextra;
+	unsigned iextra;	/* extra[0...iextra-1] are in use */
+	} node_pool = {nodes, 0, NODE_COUNT, 1, 0, 0, NULL, NULL, 0, 0};
+
+	/* Slot pool.
+	** Small child tables (up to SLOT_CLASS_MAX slots) are allocated from
+	** SLOT_SLAB_SIZE slabs, with a separate freelist per size class.
+	** (the power-of-two sizes of the tables produce only a handful of distinct small sizes)
+	** Bigger tables are rare, and are left to malloc().
+	*/
+#define SLOT_CLASS_MAX 32
+#define SLOT_SLAB_SIZE (128*1024)	/* 2MB: one huge page */
+union slotfree {
+	union slotfree *next;
+	struct treeslot slot;
+	};
+
+static struct slotpool {
+	struct treeslot *slab;	/* current slab */
+	unsigned mused;
+	unsigned nslab;
+	unsigned long nfree[1+SLOT_CLASS_MAX];
+	unsigned long ninuse[1+SLOT_CLASS_MAX];
+	unsigned long nbig;	/* malloc()d arrays, bigger than SLOT_CLASS_MAX */
+	union slotfree *freelist[1+SLOT_CLASS_MAX];
+	} slot_pool = {NULL, SLOT_SLAB_SIZE, 0, {0,}, {0,}, 0, {NULL,}};
+#else
+	/* Node table.
+	** The table is a growable array of nodes, addressed by NodeNum.
+	** It grows in chunks of NODE_CHUNK_SIZE nodes, so existing nodes never move
+	** and TREE pointers stay valid.
+	** Freed nodes are chained via ->next on the freelist, and are recycled first.
+	** The hash table is indexed by (parent,symbol), and chained via ->link.
+	** It is doubled whenever it gets more entries than buckets.
+	** With WANT_SHARED_GRAMS, the table holds grams (two nodes each) instead,
+	** and only grams with both halves unused are on the freelist.
+	*/
+#define NODE_CHUNK_SHIFT 20
+#define NODE_CHUNK_SIZE (1u << NODE_CHUNK_SHIFT)
+#define NODE_HASH_BITS_INITIAL 16
+#if WANT_SHARED_GRAMS
+#define NODE_CHUNK_MAX 2048
+#define GRAM_PTR(num) (&node_tab.chunk[(num) >> (NODE_CHUNK_SHIFT+1)][((num) >> 1) & (NODE_CHUNK_SIZE-1)])
+#define NODE_PTR(num) (&GRAM_PTR(num)->half[(num) & 1])
+typedef struct gram NodeChunk;
+	/* Longer paths do not get a twin (the trees are order+1 deep) */
+#define GRAM_DEPTH_MAX 64
+#else
+#define NODE_CHUNK_MAX 4096
+#define NODE_PTR(num) (&node_tab.chunk[(num) >> NODE_CHUNK_SHIFT][(num) & (NODE_CHUNK_SIZE-1)])
+typedef TREE NodeChunk;
+#endif
+
+static struct nodetable {
+	NodeChunk *chunk[NODE_CHUNK_MAX];
+	unsigned nchunk;
+	NodeNum mused;		/* high water mark */
+	NodeNum freelist;
+	unsigned long nfree;	/* items on the freelist */
+	unsigned long ninuse;
+	unsigned hbits;
+	unsigned long hused;	/* number of hashed nodes (all but the roots) */
+	NodeNum *hash;
+#if WANT_SHARED_GRAMS
+	unsigned long npaired;	/* grams with both halves in use */
+	NodeNum roots;		/* the forward root; the backward root is its twin */
+#endif
+	} node_tab = {{NULL,}, 0, 0, NODE_NUM_NIL, 0, 0, 0, 0, NULL
+#if WANT_SHARED_GRAMS
+	, 0, NODE_NUM_NIL
+#endif
+	};
+#endif /* WANT_OLD_NODES */
+
+	/* Relayout.
+	** Training and Alzheimer scatter the nodes of a context over the pool.
+	** model_relayout() copies the trees into a scratch arena, and then back
+	** into the emptied pool: every node's children next to each other, each
+	** followed by their subtrees (depth first). A reply's lookups then touch
+	** far fewer cache lines and pages.
+	** It runs from megahal_relayout() (main.c: -R), and (WANT_RELAYOUT=1) after loading or training a brain.
+	** load_tree() already allocates in depth first order, so that mostly helps trained brains.
+	*/
+#ifndef WANT_RELAYOUT
+#define WANT_RELAYOUT 0
+#endif
+
+	/* Software prefetch.
+	** The context walks (evaluate_reply(), update_context(), update_model()) look up
+	** the same symbol in the nodes for all orders. The lookups are independent,
+	** but on a big brain each of them waits for a cache miss. With WANT_PREFETCH the
+	** walk first calls node_prefetch() for all orders, and resolves them afterwards,
+	** so the misses overlap.
+	*/
+#ifndef WANT_PREFETCH
+#ifdef __GNUC__
+#define WANT_PREFETCH 1
+#else
+#define WANT_PREFETCH 0
+#endif
+#endif
+#if WANT_PREFETCH
+#define PREFETCH(ptr) __builtin_prefetch((ptr), 0, 3)
+#else
+#define PREFETCH(ptr) do {} while (0)
+#endif
+
+	/* Huge pages.
+	** With hugepages set (megahal_sethugepages(), or -H) the slabs for nodes
+	** and child tables are mmap()d as HUGE_PAGE_SIZE aligned regions, and advised
+	** MADV_HUGEPAGE. So is the static nodes[] array. The node lookups then
+	** need far fewer TLB entries.
+	** If mmap() fails we fall back to malloc(). If the kernel has no (or disabled)
+	** transparent huge pages, madvise() fails and the regions keep their small pages.
+	** Regions are never freed; neither are the slabs.
+	*/
+#ifndef WANT_HUGE_PAGES
+#ifdef MADV_HUGEPAGE
+#define WANT_HUGE_PAGES 1
+#else
+#define WANT_HUGE_PAGES 0
+#endif
+#endif
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+static struct hugestats {
+	unsigned nregion;	/* mmap()d regions */
+	unsigned long long bytes;
+	int failed;	/* madvise() was refused */
+	} huge_stats = {0, 0, 0};
+
+#if WANT_OLD_NODES
+STATIC int resize_tree(TREE *tree, unsigned nchild);
+#endif
 
 STATIC TREE *add_symbol(TREE *, WordNum);
+STATIC TREE *add_symbol_node(TREE *tree, TREE *node);
 STATIC WordNum add_word_dodup(DICT *dict, STRING word);
 STATIC size_t word_format(char *buff, STRING string);
 
@@ -578,8 +1318,20 @@ STATIC void initialize_status(char *);
 
 STATIC TREE *find_symbol(TREE *node, WordNum symbol);
 STATIC TREE *find_symbol_add(TREE *, WordNum);
+#if WANT_PREFETCH
+STATIC void node_prefetch(TREE *node, WordNum symbol);
+#endif
+#if WANT_PATH_COMPRESSION
+STATIC TREE *find_symbol_view(TREE *node, WordNum symbol, TREE *view);
+#define FIND_SYMBOL_VIEW(model,node,symbol,slot) find_symbol_view((node), (symbol), &(model)->view[slot])
+#define NODE_IS_VIEW(model,node) ((node) >= (model)->view && (node) < (model)->view + 2 + (model)->order)
+#else
+#define FIND_SYMBOL_VIEW(model,node,symbol,slot) find_symbol((node), (symbol))
+#define NODE_IS_VIEW(model,node) 0
+#endif
 
 STATIC WordNum find_word(DICT *, STRING);
+STATIC WordNum find_word_hashed(DICT *, STRING, WordHash);
 STATIC DICT *new_dict(void);
 
 STATIC char *read_input(char * prompt);
@@ -589,6 +1341,7 @@ STATIC void log_output(char *);
 
 STATIC char *format_output(char *);
 STATIC void empty_dict(DICT *dict);
+STATIC void free_dict(DICT *dict);
 STATIC void free_model(MODEL *);
 STATIC void free_tree(TREE *);
 STATIC void free_string(STRING word);
@@ -599,11 +1352,92 @@ STATIC DICT *read_dict(char *filename);
 STATIC void load_dict(FILE *, DICT *);
 STATIC int load_model(char *path, MODEL *mp);
 STATIC void load_personality(MODEL **);
+	/* A node, as it is stored in the brain file */
+struct nodefile {
+	WordNum symbol;
+	UsageCnt childsum;
+	UsageCnt thevalue;
+	Stamp stamp;
+	ChildIndex branch;
+	};
+STATIC int load_node(FILE *fp, struct nodefile *this);
 STATIC TREE * load_tree(FILE *);
 STATIC void load_word(FILE *, DICT *);
+#if WANT_STRING_ARENA
+STATIC int load_dict_blob(FILE *fp, DICT *dict, unsigned used);
+#endif
 STATIC MODEL *new_model(int);
 STATIC TREE *node_new(unsigned nchild);
+STATIC TREE *node_new_root(unsigned nchild);
+STATIC TREE *node_alloc(void);
+#if WANT_SHARED_GRAMS
+STATIC TREE *gram_alloc(TREE *twin, unsigned half);
+STATIC TREE *gram_find(const WordNum *words, unsigned len);
+STATIC TREE *gram_twin(TREE *parent, WordNum symbol);
+STATIC TREE *node_new_half(TREE *twin, unsigned half);
+STATIC TREE *node_new_child(TREE *parent, TREE *twin, WordNum symbol, UsageCnt value);
+#endif
+STATIC void node_free(TREE *node);
+STATIC void node_adopt(TREE *node, TREE *child, TREE *prev);
+STATIC TREE *node_child_nth(TREE *node, ChildIndex nth);
+STATIC WordNum node_child_symbol(TREE *node, ChildIndex nth);
+STATIC void model_relayout(MODEL *model);
+#if WANT_DICT_GC
+STATIC unsigned model_compact(MODEL *model, unsigned percent);
+	/* A word, with its key for the frequency order */
+struct symbolrank {
+	WordNum symbol;
+	UsageCnt valuesum;
+	};
+#if WANT_DICT_SORT
+STATIC int symbolrank_cmp(const void *vl, const void *vr);
+#endif
+STATIC unsigned long tree_mark_symbols(TREE *node, WordNum *map, WordNum mused);
+STATIC void tree_renumber(TREE *node, WordNum *map);
+STATIC void node_rehash(TREE *node);
+#endif
+STATIC void *region_alloc(size_t size);
+STATIC void region_advise(void *ptr, size_t size);
+#if WANT_OLD_NODES
+STATIC TREE **slots_alloc(unsigned nslot);
+STATIC void slots_free(TREE **slots, unsigned nslot);
+STATIC int root_resize(TREE *root, ChildIndex csize, WordNum ssize);
+STATIC int root_append(TREE *root, TREE *child);
+#if WANT_PATH_COMPRESSION
+STATIC int node_compress(TREE *node);
+STATIC int node_unrun(TREE *node);
+STATIC void tree_compress(TREE *tree);
+#endif
+STATIC void node_move(TREE *dst, TREE *src);
+STATIC void tree_relayout(TREE *node, TREE *arena, unsigned long *used);
+STATIC void tree_slack(TREE *node, unsigned long long *slots, unsigned long long *used);
+#if WANT_COMPACT_NODES
+STATIC struct nodewide *node_wide_find(TREE *node);
+STATIC struct nodewide *node_wide_add(TREE *node);
+STATIC void node_wide_del(TREE *node);
+STATIC int node_wide_resize(unsigned newsize);
+STATIC void node_set_value(TREE *node, UsageCnt val);
+STATIC void node_set_childsum(TREE *node, UsageCnt val);
+STATIC void node_set_stamp(TREE *node, Stamp val, Stamp base);
+STATIC void node_set_msize(TREE *node, ChildIndex msize);
+STATIC void stamp_rebase(MODEL *model);
+STATIC void stamp_rebase_recurse(TREE *node, Stamp base);
+#endif
+#else
+STATIC unsigned node_hash(NodeNum parent, WordNum symbol);
+STATIC int node_hash_resize(unsigned newbits);
+STATIC NodeNum *node_hash_hnd(TREE *node, WordNum symbol);
+#endif
+#if WANT_STRING_ARENA
+STATIC STRING arena_string(DICT *dict, STRING word);
+STATIC struct strblock *arena_block(DICT *dict, size_t size);
+STATIC void arena_free(DICT *dict);
+STATIC WordNum add_word_inplace(DICT *dict, STRING word);
+#else
 STATIC STRING new_string(char *str, size_t len);
+#endif
+STATIC WordNum add_word_hashed(DICT *dict, STRING word, WordHash hash);
+STATIC WordNum add_word_store(DICT *dict, STRING word, HashVal hash, int copy);
 STATIC void print_header(FILE *);
 STATIC void save_dict(FILE *, DICT *);
 STATIC unsigned save_tree(FILE *, TREE *);
@@ -616,14 +1450,43 @@ STATIC void train(MODEL *, char *);
 STATIC void update_context(MODEL *, WordNum symbol);
 STATIC void update_model(MODEL *model, WordNum symbol);
 STATIC void warn(char *, char *, ...);
+#if !WANT_FAST_DICT
 STATIC int wordcmp(STRING one, STRING two);
+#endif
 unsigned int urnd(unsigned int range);
 
 STATIC HashVal hash_mem(void *dat, size_t len);
+#if WANT_FAST_DICT
+STATIC unsigned long long hash_mem64(void *dat, size_t len);
+#endif
+#if WANT_DICT_MPH
+STATIC unsigned mph_slot(unsigned long long hash, unsigned pilot, DictSize msize);
+STATIC struct dictmph *dict_mph_new(DictSize msize);
+STATIC void dict_mph_free(DICT *dict);
+STATIC int dict_mph_place(DICT *dict, struct dictmph *mph, unsigned long long *hash);
+STATIC int dict_mph_build(DICT *dict, unsigned long long *hash);
+STATIC int dict_mph_load(DICT *dict, char *filename, unsigned long long *hash);
+STATIC int dict_mph_save(DICT *dict, char *filename);
+STATIC void dict_mph_open(DICT *dict);
+STATIC WordNum dict_mph_find(DICT *dict, STRING word);
+STATIC WordNum dict_mph_find_hashed(DICT *dict, STRING word, unsigned long long hash);
+#define MPH_BUCKET(hash,nbucket) ((unsigned) (((hash) >> 32) * (nbucket) >> 32))
+#endif
 STATIC WordNum * dict_hnd(DICT *dict, STRING word);
+STATIC WordNum * dict_hnd_hashed(DICT *dict, STRING word, HashVal hash);
 STATIC HashVal hash_word(STRING word);
+STATIC WordHash hash_token(STRING word);
 STATIC int grow_dict(DICT *dict);
 STATIC int resize_dict(DICT *dict, unsigned newsize);
+#if WANT_FAST_DICT || WANT_CASE_FOLD
+STATIC int dict_index_resize(DICT *dict, struct dictindex **index, unsigned *bits);
+#endif
+#if WANT_CASE_FOLD
+STATIC HashVal hash_fold(STRING word);
+STATIC int word_fold_equal(STRING one, STRING two);
+STATIC void dict_fold_add(DICT *dict, WordNum symbol);
+#define DICT_CANON(dict,sym) ((dict)->entry[sym].canon != WORD_NIL ? (dict)->entry[sym].canon : (sym))
+#endif
 STATIC void format_dictslots(struct dictslot * slots, unsigned size);
 STATIC unsigned long set_dict_count(MODEL *model);
 STATIC unsigned long dict_inc_ref_recurse(DICT *dict, TREE *node);
@@ -673,21 +1536,71 @@ static DICT *alz_dict = NULL;
 STATIC void dump_model(MODEL * model, char *path, int flags);
 STATIC void dump_model_recursive(FILE *fp, TREE *tree, DICT *dict, int indent);
 
-STATIC ChildIndex *node_hnd(TREE *node, WordNum symbol);
-STATIC void format_treeslots(struct treeslot *slots , unsigned size);
 STATIC void show_memstat(char *msg);
-STATIC void treeslots_sort(struct treeslot  *slots , unsigned count);
+#if WANT_OLD_NODES
+STATIC ChildIndex node_hnd(TREE *node, WordNum symbol);
+STATIC void node_unhash(TREE *node, ChildIndex bucket);
+STATIC ChildIndex node_find_inline(TREE *node, WordNum symbol);
+STATIC unsigned child_table_size(unsigned nchild);
+STATIC unsigned child_table_grow(TREE *node);
+STATIC void format_treeslots(TREE *node);
+STATIC void treeslots_sort(TREE **slots , unsigned count);
 STATIC int treeslots_cmp(const void *vl, const void *vr);
+#if WANT_SORTED_CHILDREN
+STATIC void node_promote(TREE *tree, TREE *child);
+STATIC void node_sort_children(TREE *node);
+STATIC void node_reindex(TREE *node, ChildIndex cidx);
+#endif
+#if WANT_SAMPLERS
+STATIC ChildIndex sampler_pick(TREE *node, UsageCnt credit);
+STATIC void sampler_drop(TREE *node);
+STATIC void sampler_flush(void);
+#endif
+#endif
+#if WANT_FROZEN
+STATIC unsigned bit_width(unsigned long long val);
+#if !(defined(__GNUC__) && defined(__POPCNT__))
+STATIC unsigned popcount64(unsigned long long word);
+#endif
+STATIC unsigned select64(unsigned long long bits, unsigned rem);
+STATIC unsigned bits_get(unsigned long long *bits, unsigned long long pos, unsigned width);
+STATIC void bits_put(unsigned long long *bits, unsigned long long pos, unsigned width, unsigned val);
+STATIC unsigned long louds_select0(unsigned long idx);
+STATIC unsigned long louds_next0(unsigned long pos, unsigned long idx);
+STATIC unsigned frozen_level(unsigned long num);
+STATIC WordNum frozen_symbol(unsigned long num);
+STATIC UsageCnt frozen_cum(unsigned long num);
+STATIC TREE *frozen_fill(TREE *view, unsigned long num, UsageCnt value);
+STATIC TREE *frozen_find(TREE *node, WordNum symbol, TREE *view);
+STATIC WordNum frozen_pick(TREE *node, UsageCnt credit);
+STATIC int frozen_load(FILE *fp, MODEL *model);
+STATIC int frozen_read(FILE *fp, struct frozenbuild *lev, unsigned depth);
+STATIC int frozen_build(struct frozenbuild *lev, unsigned nlevel);
+STATIC int frozen_rootkid(void);
+STATIC int frozen_rec_cmp(const void *vl, const void *vr);
+STATIC unsigned long frozen_dict_count(DICT *dict);
+STATIC void frozen_free(void);
+#endif
 
 STATIC STRING word_dup_lowercase(STRING org);
 STATIC STRING word_dup_initcaps(STRING org);
 STATIC STRING word_dup_othercase(STRING org);
+STATIC WordNum dict_lowercase(DICT *dict, WordNum symbol);
+STATIC WordNum dict_initcaps(DICT *dict, WordNum symbol);
+STATIC WordNum dict_othercase(DICT *dict, WordNum symbol);
 	/* The weight we want we want to associate with a word.
 	** if want_other is nonzero, we are also interested in
 	** other capitalisations of the word.
 	*/
 STATIC double word_weight(DICT *dict, STRING word, int want_other);
 STATIC double symbol_weight(DICT *dict, WordNum symbol, int want_other);
+STATIC double symbol_weight_calc(DICT *dict, WordNum symbol, int want_other);
+#if WANT_WEIGHT_CACHE
+STATIC int weight_resize(DICT *dict);
+#define DICT_TOUCH(dict) ((dict)->epoch++)
+#else
+#define DICT_TOUCH(dict) ((void)0)
+#endif
 	/* Callback functions for crosstab */
 STATIC double symbol_weight_callback(WordNum sym);
 STATIC size_t symbol_format_callback(char *buff, WordNum sym);
@@ -720,15 +1633,20 @@ struct sentence {
 	unsigned short totlen;
 	struct	{
 		STRING string;
+		WordHash hash; /* hash_token(string), if symbol is WORD_NIL */
+		WordNum symbol; /* the word's symbol, if it came from the dict */
 		} *entry;
 	} ;
 struct sentence *glob_input = NULL;
 // struct sentence *glob_greets = NULL;
 STATIC void make_words(char * str, struct sentence * dst);
 STATIC void add_word_to_sentence(struct sentence *dst, STRING word);
+STATIC void add_symbol_to_sentence(struct sentence *dst, DICT *dict, WordNum symbol);
+STATIC WordNum sentence_symbol(DICT *dict, struct sentence *src, unsigned idx);
 STATIC void learn_from_input(MODEL * mp, struct sentence *src);
 STATIC char *generate_reply(MODEL *mp, struct sentence *src);
 STATIC double evaluate_reply(MODEL *model, struct sentence *sentence);
+STATIC double context_probability(MODEL *model, WordNum symbol, unsigned *count);
 STATIC struct sentence * sentence_new(void);
 STATIC int sentence_grow(struct sentence *ptr);
 STATIC int sentence_resize(struct sentence *ptr, unsigned newsize);
@@ -772,6 +1690,17 @@ void megahal_setnobanner (void)
     nobanner = 1;
 }
 
+void megahal_sethugepages (void)
+{
+    hugepages = 1;
+}
+
+	/* Serve from a frozen brain: read-only (a no-op without WANT_FROZEN) */
+void megahal_setfrozen (void)
+{
+    frozen = WANT_FROZEN;
+}
+
 void megahal_seterrorfile(char *filename)
 {
     errorfilename = filename;
@@ -817,6 +1746,10 @@ void megahal_initialize(void)
 
     glob_input = sentence_new();
     // glob_greets = sentence_new();
+#if WANT_OLD_NODES
+	/* the first slab */
+    region_advise(nodes, sizeof nodes);
+#endif
     change_personality(NULL, 0, &glob_model);
     while (bogus--) urnd(42);
 }
@@ -891,6 +1824,33 @@ void megahal_cleanup(void)
     exithal();
 }
 
+/*
+   megahal_relayout --
+
+   Pack the brain's nodes in depth-first order, eg after a lot of Alzheimer churn.
+
+  */
+
+void megahal_relayout(void)
+{
+    model_relayout(glob_model);
+}
+
+/*
+   megahal_compact --
+
+   Drop the unused words from the dictionary, and renumber the rest.
+   (save_model() only does so when enough of them are unused.)
+
+  */
+
+void megahal_compact(void)
+{
+#if WANT_DICT_GC
+    if (model_compact(glob_model, 0)) glob_dirt += 1;
+#endif
+}
+
 
 
 /*---------------------------------------------------------------------------*/
@@ -1039,6 +1999,13 @@ STATIC void warn(char *title, char *fmt, ...)
 
 STATIC void show_memstat(char *msg)
 {
+#if WANT_OLD_NODES
+unsigned idx;
+unsigned long inuse=0, nfree=0;
+unsigned long long bytes=0, slots=0, used=0;
+#endif
+DICT *dict;
+
 if (!msg) msg = "..." ;
 
 status( "[ stamp Min=%u Max=%u ]\n", (unsigned) stamp_min, (unsigned) stamp_max);
@@ -1049,31 +2016,129 @@ status ("Memstat %s: {wordcnt=%u nodecnt=%u alloc=%u free=%u alzheimer=%u symdel
 	, memstats.alzheimer , memstats.symdel , memstats.treedel
 	, memstats.tokens_read
 	);
-}
-/*---------------------------------------------------------------------------*/
-
-STATIC void initialize_status(char *filename)
-{
-    if (statusfp != stdout) fclose(statusfp);
-    if (!filename) return ;
-    statusfp = fopen(filename, "a");
-    if (!statusfp) {
-	statusfp = stdout;
-	return ;
-    }
-    print_header(statusfp);
-    return ;
-}
-
-/*---------------------------------------------------------------------------*/
-
-/*
- */
-STATIC void status(char *fmt, ...)
-{
-    va_list argp;
 
-    va_start(argp, fmt);
+#if WANT_OLD_NODES
+for (idx=1; idx <= SLOT_CLASS_MAX; idx++) {
+	inuse += slot_pool.ninuse[idx];
+	nfree += slot_pool.nfree[idx];
+	bytes += (unsigned long long) idx * (slot_pool.ninuse[idx]+slot_pool.nfree[idx]) * sizeof (struct treeslot);
+	}
+status ("Nodepool %s: {slabs=%u inuse=%lu free=%lu unused=%u nodesize=%u} Slotpool: {slabs=%u inuse=%lu free=%lu bytes=%llu big=%lu}\n"
+	, msg
+	, node_pool.nslab, node_pool.ninuse, node_pool.nfree, node_pool.msize - node_pool.mused, (unsigned) sizeof (TREE)
+	, slot_pool.nslab, inuse, nfree, bytes, slot_pool.nbig
+	);
+#if WANT_COMPACT_NODES
+status ("Widetable %s: {size=%u used=%u bytes=%llu} Stamp base=%u\n"
+	, msg
+	, node_wide.msize, node_wide.mused
+	, (unsigned long long) node_wide.msize * sizeof *node_wide.slots
+	, (unsigned) stamp_base
+	);
+#endif
+if (glob_model && glob_model->forward && !frozen) tree_slack(glob_model->forward, &slots, &used);
+if (glob_model && glob_model->backward && !frozen) tree_slack(glob_model->backward, &slots, &used);
+status ("Slack %s: {childslots=%llu used=%llu bytes=%llu resize=%lu moved=%llu}\n"
+	, msg
+	, slots, used
+	, (slots - used) * sizeof (struct treeslot)
+	, grow_stats.child_resize, grow_stats.child_moved
+	);
+#else
+status ("Nodetable %s: {chunks=%u used=%u inuse=%lu free=%lu bytes=%llu} Hash: {size=%u used=%lu}\n"
+	, msg
+	, node_tab.nchunk, (unsigned) node_tab.mused, node_tab.ninuse, node_tab.nfree
+	, (unsigned long long) node_tab.nchunk * NODE_CHUNK_SIZE * sizeof **node_tab.chunk
+		+ (node_tab.hbits ? (sizeof *node_tab.hash << node_tab.hbits) : 0)
+	, node_tab.hbits ? 1u << node_tab.hbits : 0, node_tab.hused
+	);
+#if WANT_SHARED_GRAMS
+status ("Grams %s: {paired=%lu single=%lu}\n"
+	, msg
+	, node_tab.npaired, node_tab.ninuse - 2 * node_tab.npaired
+	);
+#endif
+#endif
+dict = glob_model ? glob_model->dict : NULL;
+if (dict) status ("Dictslack %s: {size=%u used=%u bytes=%llu resize=%lu moved=%llu}\n"
+	, msg
+	, (unsigned) dict->msize, (unsigned) dict->mused
+	, (unsigned long long) (dict->msize - dict->mused) * sizeof *dict->entry
+	, grow_stats.dict_resize, grow_stats.dict_moved
+	);
+#if WANT_FAST_DICT
+if (dict) status ("Dictindex %s: {slots=%u used=%u bytes=%llu}\n"
+	, msg
+	, 1u << dict->hbits, (unsigned) dict->mused
+	, (unsigned long long) sizeof *dict->index << dict->hbits
+	);
+#endif
+#if WANT_DICT_MPH
+if (dict && dict->mph) status ("Dictmph %s: {words=%u buckets=%u bytes=%llu}\n"
+	, msg
+	, (unsigned) dict->mph->msize, dict->mph->nbucket
+	, (unsigned long long) dict->mph->nbucket * sizeof *dict->mph->pilot + (unsigned long long) dict->mph->msize * sizeof *dict->mph->slot
+	);
+#endif
+#if WANT_CASE_FOLD
+if (dict) status ("Foldindex %s: {slots=%u bytes=%llu}\n"
+	, msg
+	, 1u << dict->fbits
+	, (unsigned long long) sizeof *dict->foldindex << dict->fbits
+	);
+#endif
+#if WANT_STRING_ARENA
+if (dict) {
+	struct strblock *blk;
+	unsigned nblock = 0;
+	unsigned long long asize = 0, aused = 0;
+	for (blk = dict->arena; blk; blk = blk->next) { nblock++; asize += blk->size; aused += blk->used; }
+	status ("Arena %s: {blocks=%u bytes=%llu used=%llu}\n", msg, nblock, asize, aused);
+	}
+#endif
+#if WANT_WEIGHT_CACHE
+if (weight_stats.nask) status ("Weights %s: {asked=%llu computed=%lu size=%u}\n"
+	, msg, weight_stats.nask, weight_stats.ncalc, dict ? (unsigned) dict->wsize : 0);
+#endif
+if (babble_stats.npick) status ("Babble %s: {picks=%lu steps=%llu avg=%.2f sampled=%lu}\n"
+	, msg, babble_stats.npick, babble_stats.nstep
+	, (double) babble_stats.nstep / babble_stats.npick, babble_stats.nsample);
+#if WANT_SAMPLERS
+status ("Samplers %s: {built=%lu dropped=%lu bytes=%llu}\n"
+	, msg, sampler_cache.nbuild, sampler_cache.ndrop, sampler_cache.bytes);
+#endif
+if (hugepages) status ("Hugepages %s: {regions=%u bytes=%llu failed=%d}\n"
+	, msg, huge_stats.nregion, huge_stats.bytes, huge_stats.failed);
+#if WANT_FROZEN
+if (frozen_brain.nnode) status ("Frozen %s: {nodes=%lu levels=%u bytes=%llu bits/node=%.1f}\n"
+	, msg, frozen_brain.nnode, frozen_brain.nlevel, frozen_brain.bytes
+	, 8.0 * frozen_brain.bytes / frozen_brain.nnode);
+#endif
+}
+/*---------------------------------------------------------------------------*/
+
+STATIC void initialize_status(char *filename)
+{
+    if (statusfp != stdout) fclose(statusfp);
+    if (!filename) return ;
+    statusfp = fopen(filename, "a");
+    if (!statusfp) {
+	statusfp = stdout;
+	return ;
+    }
+    print_header(statusfp);
+    return ;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ */
+STATIC void status(char *fmt, ...)
+{
+    va_list argp;
+
+    va_start(argp, fmt);
     vfprintf(statusfp, fmt, argp);
     va_end(argp);
     fflush(statusfp);
@@ -1181,31 +2246,94 @@ if (!dst) return ;
 
 if (dst->mused >= dst->msize && sentence_grow(dst)) return ;
 
+	/* Hashed once, here, while the token is still hot: dict probes reuse it */
+dst->entry[dst->mused].hash = hash_token(word);
+dst->entry[dst->mused].symbol = WORD_NIL;
 dst->entry[dst->mused++].string = word;
 dst->totlen += (1+word.length);
 
 return ;
 
+}
+
+	/* A generated word: its symbol is known, so it is not hashed */
+STATIC void add_symbol_to_sentence(struct sentence *dst, DICT *dict, WordNum symbol)
+{
+
+if (!dst) return ;
+
+if (dst->mused >= dst->msize && sentence_grow(dst)) return ;
+
+dst->entry[dst->mused].hash = 0;
+dst->entry[dst->mused].symbol = symbol;
+dst->entry[dst->mused++].string = dict->entry[symbol].string;
+dst->totlen += (1+dict->entry[symbol].string.length);
+
+return ;
+
+}
+
+STATIC WordNum sentence_symbol(DICT *dict, struct sentence *src, unsigned idx)
+{
+
+if (src->entry[idx].symbol != WORD_NIL) return src->entry[idx].symbol;
+return find_word_hashed(dict, src->entry[idx].string, src->entry[idx].hash );
+
 }
 /*---------------------------------------------------------------------------*/
 
 STATIC WordNum add_word_dodup(DICT *dict, STRING word)
 {
+return add_word_store(dict, word, hash_word(word), 1);
+}
+
+#if WANT_STRING_ARENA
+	/* Like add_word_dodup(), for a word that already lives in the dict's arena */
+STATIC WordNum add_word_inplace(DICT *dict, STRING word)
+{
+return add_word_store(dict, word, hash_word(word), 0);
+}
+#endif
+
+	/* Like add_word_dodup(), for a word whose hash_token() is already known */
+STATIC WordNum add_word_hashed(DICT *dict, STRING word, WordHash hash)
+{
+return add_word_store(dict, word, hash, 1);
+}
+
+STATIC WordNum add_word_store(DICT *dict, STRING word, HashVal hash, int copy)
+{
 WordNum *np;
 
 if (!word.length) return 0; /* WP: should be WORD_NIL */
 
-np = dict_hnd(dict, word);
+np = dict_hnd_hashed(dict, word, hash);
 if (!np) return 0; /* WP: should be WORD_NIL */
 
 if (*np == WORD_NIL) {
 	STRING this;
+	if (!copy) this = word;
+	else	{
+#if WANT_STRING_ARENA
+		this = arena_string(dict, word);
+#else
+		this = new_string(word.word, word.length);
+#endif
+		if (!this.word) return 0; /* WP: should be WORD_NIL */
+		}
 	*np = dict->mused++;
-	this = new_string(word.word, word.length);
 	dict->entry[*np].string = this;
 #if WANT_STORE_HASH
-	dict->entry[*np].whash = hash_word(this);
+	dict->entry[*np].whash = hash;
 #endif /* WANT_STORE_HASH */
+#if WANT_CASE_FOLD
+	dict_fold_add(dict, *np);
+#endif
+		/* (a new word may be another's othercase) */
+	DICT_TOUCH(dict);
+#if WANT_DICT_MPH
+	if (dict->mph) dict_mph_free(dict);
+#endif
 	}
 return *np;
 
@@ -1243,6 +2371,7 @@ if (this == dict->entry[this].link) {
 dict->entry[this].link = WORD_NIL;
 
 if ( dict->entry[this].stats.nnode ) dict->stats.nonzero -= 1;
+DICT_TOUCH(dict);
 dict->stats.nnode -= dict->entry[this].stats.nnode;
 dict->stats.valuesum -= dict->entry[this].stats.valuesum;
 free (dict->entry[this].string.word );
@@ -1298,12 +2427,31 @@ STATIC WordNum find_word(DICT *dict, STRING string)
 WordNum *np;
 
 if (!dict) return WORD_NIL; /* WP: Changed sentinel to WORD_NIL */
+#if WANT_DICT_MPH
+if (dict->mph) return dict_mph_find(dict, string);
+#endif
 np = dict_hnd(dict, string);
 
 if (!np || *np == WORD_NIL) return WORD_NIL; /* WP: Changed sentinel to WORD_NIL */
 return *np;
 }
 
+	/* Like find_word(), for a word whose hash_token() is already known */
+STATIC WordNum find_word_hashed(DICT *dict, STRING string, WordHash hash)
+{
+WordNum *np;
+
+if (!dict) return WORD_NIL;
+#if WANT_DICT_MPH
+if (dict->mph) return dict_mph_find_hashed(dict, string, hash);
+#endif
+np = dict_hnd_hashed(dict, string, hash);
+
+if (!np || *np == WORD_NIL) return WORD_NIL;
+return *np;
+}
+
+#if !WANT_STRING_ARENA
 STATIC STRING new_string(char *str, size_t len)
 {
 STRING this = {0,0,0,NULL};
@@ -1320,9 +2468,58 @@ else	{
      }
 return this;
 }
+#endif /* !WANT_STRING_ARENA */
+
+#if WANT_STRING_ARENA
+	/* A copy of word, in the dict's newest block */
+STATIC STRING arena_string(DICT *dict, STRING word)
+{
+STRING this = {0,0,0,NULL};
+struct strblock *blk;
+
+blk = dict->arena;
+if (!blk || blk->used + word.length > blk->size) {
+	blk = arena_block(dict, STRING_BLOCK_SIZE);
+	if (!blk) return this;
+	}
+this.word = blk->data + blk->used;
+memcpy(this.word, word.word, word.length);
+blk->used += word.length;
+this.length = word.length;
+this.ztype = word_classify(this);
+return this;
+}
+
+STATIC struct strblock *arena_block(DICT *dict, size_t size)
+{
+struct strblock *blk;
+
+blk = malloc(sizeof *blk + size);
+if (!blk) {
+	warn("arena_block", "Unable to allocate %lu bytes", (unsigned long) size);
+	return NULL;
+	}
+blk->used = 0;
+blk->size = size;
+blk->next = dict->arena;
+dict->arena = blk;
+return blk;
+}
+
+STATIC void arena_free(DICT *dict)
+{
+struct strblock *blk;
+
+while ((blk = dict->arena)) {
+	dict->arena = blk->next;
+	free(blk);
+	}
+}
+#endif /* WANT_STRING_ARENA */
 
 /*---------------------------------------------------------------------------*/
 
+#if !WANT_FAST_DICT
 /*
  *		Function:	Wordcmp
  *
@@ -1346,6 +2543,7 @@ STATIC int wordcmp(STRING one, STRING two)
 
     return 0;
 }
+#endif /* !WANT_FAST_DICT */
 
 /*---------------------------------------------------------------------------*/
 
@@ -1362,6 +2560,33 @@ STATIC void empty_dict(DICT *dict)
     dict->stats.nonzero = 0;
     dict->mused = 0;
     resize_dict(dict, DICT_SIZE_INITIAL);
+#if WANT_WEIGHT_CACHE
+    free(dict->weight);
+    dict->weight = NULL;
+    dict->wsize = 0;
+    DICT_TOUCH(dict);
+#endif
+#if WANT_DICT_MPH
+    dict_mph_free(dict);
+#endif
+#if WANT_STRING_ARENA
+	/* (resize_dict() has dropped the last references) */
+    arena_free(dict);
+#endif
+}
+
+STATIC void free_dict(DICT *dict)
+{
+    if (!dict) return;
+    empty_dict(dict);
+    free(dict->entry);
+#if WANT_FAST_DICT
+    free(dict->index);
+#endif
+#if WANT_CASE_FOLD
+    free(dict->foldindex);
+#endif
+    free(dict);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -1369,11 +2594,24 @@ STATIC void empty_dict(DICT *dict)
 STATIC void free_model(MODEL *model)
 {
     if (!model) return;
+#if WANT_FROZEN
+    if (frozen) frozen_free();
+    else
+#endif
+    {
     free_tree(model->forward);
     free_tree(model->backward);
+    }
     free(model->context);
-    empty_dict(model->dict);
-    free(model->dict);
+#if WANT_PATH_COMPRESSION
+#if WANT_COMPACT_NODES
+    { unsigned idx;
+    for (idx = 0; idx < 2+model->order; idx++) node_wide_del(&model->view[idx]);
+    }
+#endif
+    free(model->view);
+#endif
+    free_dict(model->dict);
 
     free(model);
 }
@@ -1383,22 +2621,28 @@ STATIC void free_model(MODEL *model)
 STATIC void free_tree(TREE *tree)
 {
     static int level = 0;
-    unsigned int ikid;
+    ChildIndex ikid, next;
 
     if (!tree) return;
 
-    if (tree->children != NULL) {
-	// if (level == 0) progress("Freeing tree", 0, 1);
-	for(ikid = 0; ikid < tree->branch; ikid++) {
-	    level++;
-	    free_tree(tree->children[ikid].ptr);
-	    level--;
-	    // if (level == 0) progress(NULL, ikid, tree->branch);
+    // if (level == 0) progress("Freeing tree", 0, 1);
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(tree)) {
+	memstats.node_cnt -= RUN_LEN(tree);
+	memstats.free += RUN_LEN(tree);
 	}
-	// if (level == 0) progress(NULL, 1, 1);
-	free(tree->children);
+    else
+#endif
+	/* fetch the next cursor first: the child is gone after free_tree() */
+    for(ikid = CHILD_FIRST(tree); ikid != CHILD_NIL; ikid = next) {
+	next = CHILD_NEXT(tree, ikid);
+	level++;
+	free_tree(CHILD_PTR(tree, ikid));
+	level--;
+	// if (level == 0) progress(NULL, ikid, tree->branch);
     }
-    free(tree);
+    // if (level == 0) progress(NULL, 1, 1);
+    node_free(tree);
     memstats.node_cnt -= 1;
     memstats.free += 1;
 }
@@ -1426,7 +2670,10 @@ unsigned ret=0;
 
 if (!model) return 0;
        /* all words are born unrefd */
-if (model->dict) model->dict->stats.nonzero = 0;
+if (model->dict) { model->dict->stats.nonzero = 0; DICT_TOUCH(model->dict); }
+#if WANT_FROZEN
+if (frozen) return frozen_dict_count(model->dict);
+#endif
 ret += dict_inc_ref_recurse(model->dict, model->forward);
 ret += dict_inc_ref_recurse(model->dict, model->backward);
 
@@ -1436,14 +2683,23 @@ return ret;
 STATIC unsigned long dict_inc_ref_recurse(DICT *dict, TREE *node)
 {
 WordNum symbol;
-unsigned uu,ret=0;
+ChildIndex uu;
+unsigned ret=0;
 
 if (!node) return 0;
 symbol = node->symbol;
 
-ret = dict_inc_ref(dict, symbol, 1, node->thevalue);
-for (uu=0; uu < node->branch; uu++) {
-	ret += dict_inc_ref_recurse(dict, node->children[uu].ptr);
+ret = dict_inc_ref(dict, symbol, 1, NODE_VALUE(node));
+#if WANT_PATH_COMPRESSION
+if (NODE_IS_RUN(node)) {
+	for (uu=0; uu < RUN_LEN(node); uu++) {
+		ret += dict_inc_ref(dict, RUN_SYM(node, uu), 1, 1);
+		}
+	return ret;
+	}
+#endif
+for (uu=CHILD_FIRST(node); uu != CHILD_NIL; uu = CHILD_NEXT(node, uu)) {
+	ret += dict_inc_ref_recurse(dict, CHILD_PTR(node, uu));
 	}
 return ret;
 }
@@ -1453,8 +2709,8 @@ STATIC unsigned long dict_inc_ref_node(DICT *dict, TREE *node, WordNum symbol)
 
 if (!dict || !node || symbol >= dict->mused ) return 0;
 
-if (node->thevalue <= 1) return dict_inc_ref(dict, symbol, 1, 1);
-else return dict_inc_ref(dict, symbol, 0, node->thevalue);
+if (NODE_VALUE(node) <= 1) return dict_inc_ref(dict, symbol, 1, 1);
+else return dict_inc_ref(dict, symbol, 0, NODE_VALUE(node));
 
 }
 
@@ -1464,6 +2720,7 @@ STATIC unsigned long dict_inc_ref(DICT *dict, WordNum symbol, unsigned nnode, un
 if (!dict || symbol >= dict->mused ) return 0;
 
 if (dict->entry[ symbol ].stats.nnode == 0 ) dict->stats.nonzero += 1;
+DICT_TOUCH(dict);
 dict->entry[ symbol ].stats.nnode += nnode;
 dict->entry[ symbol ].stats.valuesum += valuesum;
 dict->stats.nnode += nnode;
@@ -1479,6 +2736,7 @@ if (!dict || symbol >= dict->mused ) return 0;
 
 dict->entry[ symbol ].stats.nnode -= nnode;
 if (dict->entry[ symbol ].stats.nnode == 0 ) dict->stats.nonzero -= 1;
+DICT_TOUCH(dict);
 dict->entry[ symbol ].stats.valuesum -= valuesum;
 dict->stats.nnode -= nnode;
 dict->stats.valuesum -= valuesum;
@@ -1514,6 +2772,35 @@ STATIC DICT *new_dict(void)
     dict->mused = 0;
     dict->stats.nnode = 0;
     dict->stats.valuesum = 0;
+#if WANT_FAST_DICT
+    dict->hbits = 0;
+    dict->index = NULL;
+    if (dict_index_resize(dict, &dict->index, &dict->hbits)) {
+	free(dict->entry);
+	free(dict);
+	return NULL;
+	}
+#endif
+#if WANT_CASE_FOLD
+    dict->fbits = 0;
+    dict->foldindex = NULL;
+    if (dict_index_resize(dict, &dict->foldindex, &dict->fbits)) {
+	free(dict->entry);
+	free(dict);
+	return NULL;
+	}
+#endif
+#if WANT_STRING_ARENA
+    dict->arena = NULL;
+#endif
+#if WANT_DICT_MPH
+    dict->mph = NULL;
+#endif
+#if WANT_WEIGHT_CACHE
+    dict->epoch = 1;
+    dict->wsize = 0;
+    dict->weight = NULL;
+#endif
 
     return dict;
 }
@@ -1523,8 +2810,10 @@ STATIC void format_dictslots(struct dictslot * slots, unsigned size)
     unsigned idx;
 
     for (idx = 0; idx < size; idx++) {
+#if !WANT_FAST_DICT
 	slots[idx].tabl = WORD_NIL;
 	slots[idx].link = WORD_NIL;
+#endif
 #if WANT_STORE_HASH
 	slots[idx].whash = 0xe;
 #endif /* WANT_STORE_HASH */
@@ -1532,6 +2821,10 @@ STATIC void format_dictslots(struct dictslot * slots, unsigned size)
 	slots[idx].stats.valuesum = 0;
 	slots[idx].string.length = 0;
 	slots[idx].string.word = NULL;
+#if WANT_CASE_FOLD
+	slots[idx].canon = WORD_NIL;
+	slots[idx].fold = WORD_NIL;
+#endif
 	}
 
 }
@@ -1540,14 +2833,28 @@ STATIC void format_dictslots(struct dictslot * slots, unsigned size)
 STATIC void save_dict(FILE *fp, DICT *dict)
 {
     unsigned int iwrd;
+    size_t size, pos;
+    char *blob;
 
     fwrite(&dict->mused, sizeof dict->mused, 1, fp);
-    // progress("Saving dictionary", 0, 1);
-    for(iwrd = 0; iwrd < dict->mused; iwrd++) {
-	save_word(fp, dict->entry[iwrd].string );
-	// progress(NULL, iwrd, dict->mused);
+	/* All the words in one write: the same bytes as save_word() for each */
+    for(size = 0, iwrd = 0; iwrd < dict->mused; iwrd++) {
+	size += sizeof dict->entry[iwrd].string.length + dict->entry[iwrd].string.length;
     }
-    // progress(NULL, 1, 1);
+    blob = malloc(size);
+    if (!blob) {
+	for(iwrd = 0; iwrd < dict->mused; iwrd++) save_word(fp, dict->entry[iwrd].string );
+	memstats.word_cnt = iwrd;
+	return;
+    }
+    for(pos = 0, iwrd = 0; iwrd < dict->mused; iwrd++) {
+	memcpy(blob+pos, &dict->entry[iwrd].string.length, sizeof dict->entry[iwrd].string.length);
+	pos += sizeof dict->entry[iwrd].string.length;
+	memcpy(blob+pos, dict->entry[iwrd].string.word, dict->entry[iwrd].string.length);
+	pos += dict->entry[iwrd].string.length;
+    }
+    fwrite(blob, size, 1, fp);
+    free(blob);
     memstats.word_cnt = iwrd;
 }
 
@@ -1564,6 +2871,12 @@ STATIC void load_dict(FILE *fp, DICT *dict)
     resize_dict(dict, dict->msize+used + kuttje + sqrt(used)); // 20150222
     /* resize_dict(dict, dict->msize+used ); */
     status("Load_dictSize=%u Initial_dictSize=%u\n", used, dict->msize);
+#if WANT_STRING_ARENA
+    if (!load_dict_blob(fp, dict, used)) {
+	memstats.word_cnt = used;
+	return;
+	}
+#endif
     // progress("Loading dictionary", 0, 1);
     for(iwrd = 0; iwrd < used; iwrd++) {
 	load_word(fp, dict);
@@ -1573,6 +2886,40 @@ STATIC void load_dict(FILE *fp, DICT *dict)
     memstats.word_cnt = used;
 }
 
+#if WANT_STRING_ARENA
+	/* The dict is the last part of a brainfile: read the rest of the file in one go,
+	** into a block of its own, and let the words point into it.
+	** Returns -1 (nothing read) if the file's size is unknown, or too big to allocate. */
+STATIC int load_dict_blob(FILE *fp, DICT *dict, unsigned used)
+{
+    struct stat st;
+    struct strblock *blob;
+    STRING word = {0,0,0,NULL};
+    unsigned iwrd;
+    long here;
+    size_t pos;
+
+    here = ftell(fp);
+    if (here < 0 || fstat(fileno(fp), &st) || !S_ISREG(st.st_mode) || st.st_size < here) return -1;
+    blob = arena_block(dict, st.st_size - here);
+    if (!blob) return -1;
+    blob->used = fread(blob->data, 1, blob->size, fp);
+
+    for(pos = 0, iwrd = 0; iwrd < used; iwrd++) {
+	if (pos + sizeof word.length > blob->used) break;
+	memcpy(&word.length, blob->data+pos, sizeof word.length);
+	pos += sizeof word.length;
+	if (pos + word.length > blob->used) break;
+	word.word = blob->data+pos;
+	word.ztype = word_classify(word);
+	add_word_inplace(dict, word);
+	pos += word.length;
+    }
+    if (iwrd < used) warn("load_dict", "Truncated dictionary: %u of %u words", iwrd, used);
+    return 0;
+}
+#endif /* WANT_STRING_ARENA */
+
 /*---------------------------------------------------------------------------*/
 
 STATIC void save_word(FILE *fp, STRING word)
@@ -1603,503 +2950,2808 @@ STATIC void load_word(FILE *fp, DICT *dict)
 
 /*---------------------------------------------------------------------------*/
 
+	/* Memory for a slab. (see WANT_HUGE_PAGES) */
+STATIC void *region_alloc(size_t size)
+{
+#if WANT_HUGE_PAGES
+    char *base, *ptr;
+    size_t len;
+
+    if (!hugepages) return malloc(size);
+    size = (size + HUGE_PAGE_SIZE-1) & ~(size_t)(HUGE_PAGE_SIZE-1);
+	/* mmap() only aligns to the small page size: map one huge page extra, and trim */
+    len = size + HUGE_PAGE_SIZE;
+    base = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+	warn("region_alloc", "Unable to map %lu bytes: %s; using malloc()", (unsigned long) len, strerror(errno));
+	return malloc(size);
+	}
+    ptr = (char *) (((size_t) base + HUGE_PAGE_SIZE-1) & ~(size_t)(HUGE_PAGE_SIZE-1));
+    if (ptr > base) munmap(base, ptr - base);
+    if (ptr + size < base + len) munmap(ptr + size, (base + len) - (ptr + size));
+    region_advise(ptr, size);
+    huge_stats.nregion += 1;
+    huge_stats.bytes += size;
+    return ptr;
+#else
+    return malloc(size);
+#endif
+}
+
+	/* Ask for huge pages on the aligned interior of [ptr, ptr+size) */
+STATIC void region_advise(void *ptr, size_t size)
+{
+#if WANT_HUGE_PAGES
+    char *beg, *end;
+
+    if (!hugepages || huge_stats.failed) return;
+    beg = (char *) (((size_t) ptr + HUGE_PAGE_SIZE-1) & ~(size_t)(HUGE_PAGE_SIZE-1));
+    end = (char *) (((size_t) ptr + size) & ~(size_t)(HUGE_PAGE_SIZE-1));
+    if (end <= beg) return;
+    if (madvise(beg, end - beg, MADV_HUGEPAGE)) {
+	huge_stats.failed = errno;
+	warn("region_advise", "No transparent huge pages: %s; using normal pages", strerror(errno));
+	}
+#else
+    (void) ptr; (void) size;
+#endif
+}
+
 STATIC TREE *node_new(unsigned nchild)
 {
     TREE *node = NULL;
 
-    node = malloc(sizeof *node);
+    node = node_alloc();
     if (!node) {
 	error("node_new", "Unable to allocate the node.");
 	return NULL;
     }
 
     node->symbol = WORD_ERR;
-    node->childsum = 0;
-    node->thevalue = 0;
-    node->stamp = stamp_max;
-    node->msize = 0;
+    NODE_SET_CHILDSUM(node, 0);
+    NODE_SET_VALUE(node, 0);
+    NODE_SET_STAMP(node, stamp_max);
     node->branch = 0;
-    if (!nchild) node->children = NULL;
+#if WANT_SUFFIX_LINKS
+    node->suffix = NULL;
+#endif
+#if WANT_OLD_NODES
+    NODE_SET_MSIZE(node, 0);
+    if (nchild <= NODE_INLINE_MAX) {
+	for (nchild = 0; nchild < NODE_INLINE_MAX; nchild++) node->u.kids[nchild] = NULL;
+	}
     else {
-        node->children =  malloc (nchild * sizeof *node->children);
-        node->msize = nchild;
-        if (node->children) format_treeslots(node->children,  node->msize);
+        nchild = child_table_size(nchild);
+        node->u.children =  slots_alloc (nchild);
+        NODE_SET_MSIZE(node, nchild);
+        if (node->u.children) format_treeslots(node);
 	}
+#else
+	/* nchild is only a hint; the flat engine has no child arrays */
+    node->parent = NODE_NUM_NIL;
+    node->link = NODE_NUM_NIL;
+    node->kids = NODE_NUM_NIL;
+    node->next = NODE_NUM_NIL;
+#endif
     memstats.node_cnt += 1;
     memstats.alloc += 1;
     return node;
 
 }
 
-/*---------------------------------------------------------------------------*/
-
-STATIC MODEL *new_model(int order)
-{
-    MODEL *model = NULL;
+#if WANT_OLD_NODES
+STATIC TREE *node_alloc(void)
+{
+    union nodefree *this;
+
+    this = node_pool.freelist;
+    if (this) {
+	node_pool.freelist = this->next;
+	node_pool.nfree -= 1;
+	node_pool.ninuse += 1;
+#if WANT_COMPACT_NODES
+	/* the freelist link has overwritten the start of the node */
+	this->node.stamp = this->node.thevalue = this->node.childsum = 0;
+#endif
+	return &this->node;
+	}
 
-    model = malloc(sizeof *model);
-    if (!model) {
-	error("new_model", "Unable to allocate model.");
-        return NULL;
-    }
+    if (node_pool.mused >= node_pool.msize) {
+	TREE *slab, **extra;
+	if (node_pool.iextra < node_pool.nextra) slab = node_pool.extra[node_pool.iextra];
+	else	{
+		extra = realloc(node_pool.extra, (node_pool.nextra+1) * sizeof *extra);
+		if (!extra) return NULL;
+		node_pool.extra = extra;
+		slab = region_alloc (NODE_SLAB_SIZE * sizeof *slab);
+		if (!slab) return NULL;
+		node_pool.extra[node_pool.nextra++] = slab;
+		node_pool.nslab += 1;
+		}
+	node_pool.iextra += 1;
+	node_pool.slab = slab;
+	node_pool.mused = 0;
+	node_pool.msize = NODE_SLAB_SIZE;
+	}
+    node_pool.ninuse += 1;
+#if WANT_COMPACT_NODES
+    node_pool.slab[node_pool.mused].stamp = 0;
+    node_pool.slab[node_pool.mused].thevalue = node_pool.slab[node_pool.mused].childsum = 0;
+#endif
+    return &node_pool.slab[node_pool.mused++];
+}
 
-    model->order = order;
-    model->forward = node_new(0);
-    model->backward = node_new(0);
-    model->context = malloc( (2+order) *sizeof *model->context);
-    if (!model->context) {
-	error("new_model", "Unable to allocate context array.");
-        return NULL;
-    }
-    initialize_context(model);
-    model->dict = new_dict();
-    initialize_dict(model->dict);
+	/* Release the node and its child array (but not the children) */
+STATIC void node_free(TREE *node)
+{
+    union nodefree *this;
 
-    return model;
+    if (!node) return;
+#if WANT_SAMPLERS
+    sampler_drop(node);
+#endif
+    if (NODE_IS_DENSE(node)) {
+	free(ROOT_INDEX(node)->sidx);
+	free(ROOT_INDEX(node));
+	}
+#if WANT_PATH_COMPRESSION
+    else if (NODE_IS_RUN(node)) slots_free((TREE **) node->u.run, RUN_NSLOT(RUN_LEN(node)));
+#endif
+    else if (!NODE_IS_INLINE(node)) slots_free(node->u.children, NODE_MSIZE(node));
+#if WANT_COMPACT_NODES
+    if (node->thevalue == COUNT_WIDE || node->childsum == COUNT_WIDE || node->stamp == EPOCH_WIDE) node_wide_del(node);
+#endif
+    this = (union nodefree *) node;
+    this->next = node_pool.freelist;
+    node_pool.freelist = this;
+    node_pool.nfree += 1;
+    node_pool.ninuse -= 1;
 }
 
-/*---------------------------------------------------------------------------*/
-
-STATIC void update_model(MODEL *model, WordNum symbol)
+	/* Append child to node. Only used by load_tree(), which has
+	** presized the child array. prev is not needed here. */
+STATIC void node_adopt(TREE *node, TREE *child, TREE *prev)
 {
-    unsigned int iord;
-	/* this is a bit defensive; these symbols should never occur */
-    if (symbol == WORD_NIL) return;
-    if (symbol == WORD_ERR) return;
-    /*
-     *	Update all of the models in the current context with the specified
-     *	symbol.
-     */
-    for(iord = model->order+1; iord > 0; iord--) {
-	if ( !model->context[iord-1] ) continue;
-	model->context[iord] = add_symbol(model->context[iord-1], symbol);
-	dict_inc_ref_node(model->dict, model->context[iord], symbol);
-	}
+    ChildIndex bucket;
 
-    return;
+    if (NODE_IS_INLINE(node)) {
+	if (node->branch < NODE_INLINE_MAX) node->u.kids[node->branch++] = child;
+	return;
+	}
+    if (NODE_IS_DENSE(node)) {
+	(void) root_append(node, child);
+	return;
+	}
+    if (node->branch >= NODE_MSIZE(node)) return;
+    bucket = node_hnd(node, child->symbol);
+    if (bucket == CHILD_NIL) return;
+    CHILD_HSYM(node)[bucket] = child->symbol;
+    CHILD_HIDX(node)[bucket] = node->branch;
+    node->u.children[node->branch++] = child;
 }
 
-/*---------------------------------------------------------------------------*/
+STATIC TREE *node_child_nth(TREE *node, ChildIndex nth)
+{
+    if (nth >= node->branch) return NULL;
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(node) && node_unrun(node)) return NULL;
+#endif
+    return CHILD_PTR(node, nth);
+}
 
-STATIC void update_context(MODEL *model, WordNum symbol)
+	/* A root node, with a dense index (if enabled) */
+STATIC TREE *node_new_root(unsigned nchild)
 {
-    unsigned int iord;
+    TREE *node;
 
-    for(iord = model->order+1; iord > 0; iord--) {
-	if ( !model->context[iord-1] ) continue;
-	model->context[iord] = find_symbol(model->context[iord-1], symbol);
+#if WANT_DENSE_ROOT
+    node = node_new(0);
+    if (!node) return NULL;
+    node->u.children = NULL;
+    NODE_SET_MSIZE(node, CHILD_DENSE);
+    if (root_resize(node, nchild, 0)) {
+	NODE_SET_MSIZE(node, 0);
+	node_free(node);
+	memstats.node_cnt -= 1;
+	memstats.free += 1;
+	return NULL;
 	}
+#else
+    node = node_new(nchild);
+#endif
+    return node;
 }
 
-/*---------------------------------------------------------------------------*/
+	/* Grow the root's children[] to hold csize children, and its sidx[] to cover ssize symbols.
+	** Sizes are rounded up to powers of two. Nothing is ever shrunk.
+	*/
+STATIC int root_resize(TREE *root, ChildIndex csize, WordNum ssize)
+{
+    struct rootindex *ri, *new;
+    ChildIndex *sidx;
+    unsigned size, idx;
+
+    ri = root->u.children ? ROOT_INDEX(root) : NULL;
+    if (ri && csize <= ri->csize && ssize <= ri->ssize) return 0;
+
+    size = ri ? ri->csize : 0;
+    if (!ri || csize > size) {
+	for (size = size ? size : ROOT_SIZE_INITIAL; size < csize; size *= 2) {;}
+	new = realloc(ri, sizeof *new + size * sizeof *new->children);
+	if (!new) {
+		error("Root_resize", "Unable to reallocate root children: %u", size);
+		return -1;
+		}
+	if (!ri) { new->ssize = 0; new->sidx = NULL; }
+	new->csize = size;
+	root->u.children = new->children;
+	ri = new;
+	}
+
+    if (ssize > ri->ssize) {
+	for (size = ri->ssize ? ri->ssize : ROOT_SIZE_INITIAL; size < ssize; size *= 2) {;}
+	sidx = realloc(ri->sidx, size * sizeof *sidx);
+	if (!sidx) {
+		error("Root_resize", "Unable to reallocate root index: %u", size);
+		return -1;
+		}
+	for (idx = ri->ssize; idx < size; idx++) sidx[idx] = CHILD_NIL;
+	ri->sidx = sidx;
+	ri->ssize = size;
+	}
+    return 0;
+}
+
+	/* Append child to a dense root. The caller has checked that it is not present yet. */
+STATIC int root_append(TREE *root, TREE *child)
+{
+    struct rootindex *ri;
+
+    ri = ROOT_INDEX(root);
+    if (root->branch >= ri->csize || child->symbol >= ri->ssize) {
+	if (root_resize(root, root->branch+1, child->symbol+1)) return -1;
+	ri = ROOT_INDEX(root);
+	}
+    ri->sidx[child->symbol] = root->branch;
+    root->u.children[root->branch++] = child;
+    return 0;
+}
+
+#if WANT_COMPACT_NODES
+STATIC struct nodewide *node_wide_find(TREE *node)
+{
+    unsigned slot, mask;
+
+    if (!node_wide.msize) return NULL;
+    mask = node_wide.msize - 1;
+    for (slot = WIDE_HASH(node) & mask; node_wide.slots[slot].node; slot = (slot+1) & mask) {
+	if (node_wide.slots[slot].node == node) return &node_wide.slots[slot];
+	}
+    return NULL;
+}
+
+	/* Find or create the node's entry. The caller fills in the field it escapes. */
+STATIC struct nodewide *node_wide_add(TREE *node)
+{
+    struct nodewide *entry;
+    unsigned slot, mask;
+
+    entry = node_wide_find(node);
+    if (entry) return entry;
+    if (4 * (node_wide.mused+1) > 3 * node_wide.msize) {
+	if (node_wide_resize(node_wide.msize ? 2 * node_wide.msize : WIDE_SIZE_INITIAL)) return NULL;
+	}
+    mask = node_wide.msize - 1;
+    for (slot = WIDE_HASH(node) & mask; node_wide.slots[slot].node; slot = (slot+1) & mask) {;}
+    entry = &node_wide.slots[slot];
+    entry->node = node;
+    node_wide.mused += 1;
+    return entry;
+}
+
+	/* Remove the node's entry (if any), and shift the rest of the cluster back */
+STATIC void node_wide_del(TREE *node)
+{
+    struct nodewide *entry;
+    unsigned slot, next, home, mask;
+
+    entry = node_wide_find(node);
+    if (!entry) return;
+    mask = node_wide.msize - 1;
+    slot = entry - node_wide.slots;
+    for (next = (slot+1) & mask; node_wide.slots[next].node; next = (next+1) & mask) {
+	home = WIDE_HASH(node_wide.slots[next].node) & mask;
+	if (((next - home) & mask) < ((next - slot) & mask)) continue;
+	node_wide.slots[slot] = node_wide.slots[next];
+	slot = next;
+	}
+    node_wide.slots[slot].node = NULL;
+    node_wide.mused -= 1;
+}
+
+STATIC int node_wide_resize(unsigned newsize)
+{
+    struct nodewide *old, *new;
+    unsigned oldsize, idx, slot;
+
+    new = calloc(newsize, sizeof *new);
+    if (!new) {
+	error("node_wide_resize", "Unable to allocate the wide table: %u", newsize);
+	return -1;
+	}
+    old = node_wide.slots;
+    oldsize = node_wide.msize;
+    node_wide.slots = new;
+    node_wide.msize = newsize;
+    for (idx = 0; idx < oldsize; idx++) {
+	if (!old[idx].node) continue;
+	for (slot = WIDE_HASH(old[idx].node) & (newsize-1); new[slot].node; slot = (slot+1) & (newsize-1)) {;}
+	new[slot] = old[idx];
+	}
+    free(old);
+    return 0;
+}
+
+	/* Drop the node's wide entry, once none of its fields need it */
+#define NODE_WIDE_CHECK(node) do { if ((node)->thevalue != COUNT_WIDE && (node)->childsum != COUNT_WIDE \
+	&& (node)->stamp != EPOCH_WIDE) node_wide_del(node); } while(0)
+
+STATIC void node_set_value(TREE *node, UsageCnt val)
+{
+    struct nodewide *entry;
+
+    if (val < COUNT_WIDE) {
+	if (node->thevalue == COUNT_WIDE) { node->thevalue = val; NODE_WIDE_CHECK(node); }
+	else node->thevalue = val;
+	return;
+	}
+    entry = node_wide_add(node);
+    if (!entry) return;
+    entry->thevalue = val;
+    node->thevalue = COUNT_WIDE;
+}
+
+STATIC void node_set_childsum(TREE *node, UsageCnt val)
+{
+    struct nodewide *entry;
+
+    if (val < COUNT_WIDE) {
+	if (node->childsum == COUNT_WIDE) { node->childsum = val; NODE_WIDE_CHECK(node); }
+	else node->childsum = val;
+	return;
+	}
+    entry = node_wide_add(node);
+    if (!entry) return;
+    entry->childsum = val;
+    node->childsum = COUNT_WIDE;
+}
+
+	/* Stamps outside [base, base+EPOCH_WIDE) are kept in the wide table,
+	** so nothing is lost. stamp_rebase() keeps those rare. */
+STATIC void node_set_stamp(TREE *node, Stamp val, Stamp base)
+{
+    struct nodewide *entry;
+
+    if ((Stamp)(val - base) < EPOCH_WIDE) {
+	if (node->stamp == EPOCH_WIDE) { node->stamp = val - base; NODE_WIDE_CHECK(node); }
+	else node->stamp = val - base;
+	return;
+	}
+    entry = node_wide_add(node);
+    if (!entry) return;
+    entry->stamp = val;
+    node->stamp = EPOCH_WIDE;
+}
+
+STATIC void node_set_msize(TREE *node, ChildIndex msize)
+{
+    unsigned bits;
+
+    if (!msize) node->mcode = 0;
+    else if (msize == CHILD_DENSE) node->mcode = MCODE_DENSE;
+    else if (msize == CHILD_FROZEN) node->mcode = MCODE_FROZEN;
+    else if (msize >= CHILD_RUN(RUN_LEN_MAX) && msize <= CHILD_RUN(1)) {
+	node->mcode = MCODE_RUN;
+	node->rlen = (ChildIndex)-4 - msize;
+	}
+    else {
+	for (bits = 0; (1u << bits) < msize; bits++) {;}
+	node->mcode = bits;
+	}
+}
+
+	/* Move stamp_base up to stamp_min, but keep EPOCH_HEADROOM epochs free above stamp_max.
+	** Called when stamp_min advances (Alzheimer), and when stamp_max nears the top.
+	*/
+STATIC void stamp_rebase(MODEL *model)
+{
+    Stamp base;
+
+    base = stamp_min;
+    if ((Stamp)(stamp_max - base) > EPOCH_WIDE - EPOCH_HEADROOM) base = stamp_max - (EPOCH_WIDE - EPOCH_HEADROOM);
+    if (base == stamp_base) return;
+    stamp_rebase_recurse(model->forward, base);
+    stamp_rebase_recurse(model->backward, base);
+    stamp_base = base;
+}
+
+	/* Re-encode the stamps relative to the new base. (runs have full stamps) */
+STATIC void stamp_rebase_recurse(TREE *node, Stamp base)
+{
+    ChildIndex cidx;
+
+    if (!node) return;
+    node_set_stamp(node, NODE_STAMP(node), base);
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(node)) return;
+#endif
+    for (cidx = CHILD_FIRST(node); cidx != CHILD_NIL; cidx = CHILD_NEXT(node, cidx)) {
+	stamp_rebase_recurse(CHILD_PTR(node, cidx), base);
+	}
+}
+#endif /* WANT_COMPACT_NODES */
+
+#if WANT_PATH_COMPRESSION
+	/* If node's only child heads a chain of once-seen nodes with the same stamp,
+	** absorb the child (and its run) into a run in node.
+	** Bottom-up use only: the child's subtree must have been compressed already.
+	** Returns 1 if the node is a run afterwards.
+	*/
+STATIC int node_compress(TREE *node)
+{
+    TREE *child;
+    WordNum *run;
+    unsigned len, idx;
+
+    if (NODE_IS_RUN(node)) return 1;
+    if (!NODE_IS_INLINE(node) || node->branch != 1 || NODE_CHILDSUM(node) != 1) return 0;
+    child = node->u.kids[0];
+    if (NODE_VALUE(child) != 1 || NODE_CHILDSUM(child) != child->branch) return 0;
+    if (child->branch == 0) len = 1;
+    else if (NODE_IS_RUN(child) && RUN_STAMP(child) == NODE_STAMP(child)) len = 1 + RUN_LEN(child);
+    else return 0;
+    if (len > RUN_LEN_MAX) return 0;
+
+    run = (WordNum *) slots_alloc(RUN_NSLOT(len));
+    if (!run) return 0;
+    run[0] = child->symbol;
+    for (idx = 1; idx < len; idx++) run[idx] = RUN_SYM(child, idx-1);
+    run[len] = NODE_STAMP(child);
+
+    node_free(child);
+    NODE_SET_MSIZE(node, CHILD_RUN(len));
+    node->u.run = run;
+    return 1;
+}
+
+	/* Split the first node off node's run, and make it node's (inline) child.
+	** The remainder of the run moves into the new child.
+	** memstats.node_cnt counts the run's nodes already, so it is not touched.
+	*/
+STATIC int node_unrun(TREE *node)
+{
+    TREE *child;
+    WordNum *run;
+    unsigned len, idx;
+
+    if (!NODE_IS_RUN(node)) return 0;
+    child = node_alloc();
+    if (!child) {
+	error("node_unrun", "Unable to allocate the node.");
+	return -1;
+	}
+    len = RUN_LEN(node);
+    child->symbol = RUN_SYM(node, 0);
+    NODE_SET_VALUE(child, 1);
+    NODE_SET_STAMP(child, RUN_STAMP(node));
+#if WANT_SUFFIX_LINKS
+    child->suffix = NULL;
+#endif
+    for (idx = 0; idx < NODE_INLINE_MAX; idx++) child->u.kids[idx] = NULL;
+    NODE_SET_MSIZE(child, 0);
+    child->branch = 0;
+    NODE_SET_CHILDSUM(child, 0);
+    if (len > 1) {
+	run = (WordNum *) slots_alloc(RUN_NSLOT(len-1));
+	if (!run) {
+		node_free(child);
+		error("node_unrun", "Unable to allocate the run.");
+		return -1;
+		}
+	for (idx = 1; idx <= len; idx++) run[idx-1] = node->u.run[idx];
+	NODE_SET_MSIZE(child, CHILD_RUN(len-1));
+	child->u.run = run;
+	child->branch = 1;
+	NODE_SET_CHILDSUM(child, 1);
+	}
+    memstats.alloc += 1;
+
+    slots_free((TREE **) node->u.run, RUN_NSLOT(len));
+    NODE_SET_MSIZE(node, 0);
+    for (idx = 0; idx < NODE_INLINE_MAX; idx++) node->u.kids[idx] = NULL;
+    node->u.kids[0] = child;
+    return 0;
+}
+
+	/* Compress a whole tree, bottom-up.
+	** Nodes are freed, so (like Alzheimer) this drops the suffix links.
+	*/
+STATIC void tree_compress(TREE *tree)
+{
+    ChildIndex cidx;
+
+    if (!tree) return;
+#if WANT_SUFFIX_LINKS
+    tree->suffix = NULL;
+#endif
+    if (NODE_IS_RUN(tree)) return;
+    for (cidx = CHILD_FIRST(tree); cidx != CHILD_NIL; cidx = CHILD_NEXT(tree, cidx)) {
+	tree_compress(CHILD_PTR(tree, cidx));
+	}
+    (void) node_compress(tree);
+}
+#endif /* WANT_PATH_COMPRESSION */
+
+	/* Copy a node to another place. Its suffix link is dropped. */
+STATIC void node_move(TREE *dst, TREE *src)
+{
+#if WANT_COMPACT_NODES
+    struct nodewide *entry, wide;
+
+    entry = NULL;
+    if (src->thevalue == COUNT_WIDE || src->childsum == COUNT_WIDE || src->stamp == EPOCH_WIDE) {
+	entry = node_wide_find(src);
+	}
+    if (entry) {
+	wide = *entry;
+	node_wide_del(src);
+	entry = node_wide_add(dst);
+	if (entry) { wide.node = dst; *entry = wide; }
+	}
+#endif
+    *dst = *src;
+#if WANT_SUFFIX_LINKS
+    dst->suffix = NULL;
+#endif
+}
+
+	/* Move node's children to fresh nodes, all together, and then do the same
+	** for each child's subtree. The nodes are taken from arena[*used ...],
+	** or from the pool if arena is NULL.
+	*/
+STATIC void tree_relayout(TREE *node, TREE *arena, unsigned long *used)
+{
+    ChildIndex cidx;
+    TREE *new;
+
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(node)) return;
+#endif
+    for (cidx = CHILD_FIRST(node); cidx != CHILD_NIL; cidx = CHILD_NEXT(node, cidx)) {
+	new = arena ? &arena[(*used)++] : node_alloc();
+	node_move(new, CHILD_PTR(node, cidx));
+	if (NODE_IS_INLINE(node)) node->u.kids[cidx] = new;
+	else node->u.children[cidx] = new;
+	}
+    for (cidx = CHILD_FIRST(node); cidx != CHILD_NIL; cidx = CHILD_NEXT(node, cidx)) {
+	tree_relayout(CHILD_PTR(node, cidx), arena, used);
+	}
+}
+
+	/* All the nodes in the pool must belong to this model.
+	** First the trees are moved into a scratch arena. Then the pool is emptied
+	** (its slabs are kept) and the trees are moved back, in the same order.
+	** The pool has room for all of them, so the second pass cannot fail.
+	*/
+STATIC void model_relayout(MODEL *model)
+{
+    TREE *arena, *root;
+    unsigned long count, used;
+    unsigned iord;
+
+    if (!model || !model->forward || !model->backward) return;
+	/* a frozen brain has its own (level) order */
+    if (frozen) return;
+    count = node_pool.ninuse;
+    arena = malloc(count * sizeof *arena);
+    if (!arena) {
+	warn("model_relayout", "Unable to allocate the arena: %lu nodes", count);
+	return;
+	}
+#if WANT_SAMPLERS
+    sampler_flush();
+#endif
+
+    used = 0;
+    root = &arena[used++]; node_move(root, model->forward); model->forward = root;
+    tree_relayout(root, arena, &used);
+    root = &arena[used++]; node_move(root, model->backward); model->backward = root;
+    tree_relayout(root, arena, &used);
+
+    node_pool.freelist = NULL;
+    node_pool.nfree = 0;
+    node_pool.ninuse = 0;
+    node_pool.slab = nodes;
+    node_pool.mused = 0;
+    node_pool.msize = NODE_COUNT;
+    node_pool.iextra = 0;
+
+    root = node_alloc(); node_move(root, model->forward); model->forward = root;
+    tree_relayout(root, NULL, NULL);
+    root = node_alloc(); node_move(root, model->backward); model->backward = root;
+    tree_relayout(root, NULL, NULL);
+    free(arena);
+
+	/* (not initialize_context(): that would touch the roots' stamps) */
+    for (iord = 0; iord < 2+model->order; iord++) model->context[iord] = NULL;
+    status("Relayout: %lu/%lu nodes\n", used, count);
+}
+
+#if WANT_DICT_GC
+	/* Rebuild node's index (hash table or dense root) after its children were renumbered.
+	** The order of the children is kept. A dense root's sidx[] is shrunk to fit.
+	*/
+STATIC void node_rehash(TREE *node)
+{
+    struct rootindex *ri;
+    ChildIndex cidx, bucket, *sidx;
+    WordNum *hsym, ssize;
+    unsigned idx, size;
+
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(node)) return;
+#endif
+    if (NODE_IS_INLINE(node) || NODE_IS_FROZEN(node)) return;
+    if (NODE_IS_DENSE(node)) {
+	ri = ROOT_INDEX(node);
+	for (ssize = cidx = 0; cidx < node->branch; cidx++) {
+		if (node->u.children[cidx]->symbol >= ssize) ssize = node->u.children[cidx]->symbol + 1;
+		}
+	for (size = ROOT_SIZE_INITIAL; size < ssize; size *= 2) {;}
+	if (size < ri->ssize && (sidx = realloc(ri->sidx, size * sizeof *sidx))) {
+		ri->sidx = sidx;
+		ri->ssize = size;
+		}
+	for (idx = 0; idx < ri->ssize; idx++) ri->sidx[idx] = CHILD_NIL;
+	for (cidx = 0; cidx < node->branch; cidx++) ri->sidx[ node->u.children[cidx]->symbol ] = cidx;
+	return;
+	}
+    hsym = CHILD_HSYM(node);
+    for (idx = 0; idx < NODE_MSIZE(node); idx++) {
+	hsym[idx] = WORD_NIL;
+	CHILD_HIDX(node)[idx] = CHILD_NIL;
+	}
+    for (cidx = 0; cidx < node->branch; cidx++) {
+	bucket = node_hnd(node, node->u.children[cidx]->symbol);
+	hsym[bucket] = node->u.children[cidx]->symbol;
+	CHILD_HIDX(node)[bucket] = cidx;
+	}
+}
+#endif /* WANT_DICT_GC */
+
+	/* Count the slots of the child tables below node: allocated, and occupied.
+	** (the dense roots are not counted)
+	*/
+STATIC void tree_slack(TREE *node, unsigned long long *slots, unsigned long long *used)
+{
+    ChildIndex cidx;
+
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(node)) return;
+#endif
+    if (!NODE_IS_INLINE(node) && !NODE_IS_DENSE(node)) {
+	*slots += NODE_MSIZE(node);
+	*used += node->branch;
+	}
+    for (cidx = CHILD_FIRST(node); cidx != CHILD_NIL; cidx = CHILD_NEXT(node, cidx)) {
+	tree_slack(CHILD_PTR(node, cidx), slots, used);
+	}
+}
+
+STATIC TREE **slots_alloc(unsigned nslot)
+{
+    union slotfree *this;
+    struct treeslot *slots;
+
+    if (!nslot) return NULL;
+    if (nslot > SLOT_CLASS_MAX) {
+	slots = malloc (nslot * sizeof *slots);
+	if (slots) slot_pool.nbig += 1;
+	return (TREE **) slots;
+	}
+
+    this = slot_pool.freelist[nslot];
+    if (this) {
+	slot_pool.freelist[nslot] = this->next;
+	slot_pool.nfree[nslot] -= 1;
+	slot_pool.ninuse[nslot] += 1;
+	return (TREE **) &this->slot;
+	}
+
+	/* The tail of the old slab is wasted, but it is less than SLOT_CLASS_MAX slots */
+    if (slot_pool.mused + nslot > SLOT_SLAB_SIZE) {
+	slots = region_alloc (SLOT_SLAB_SIZE * sizeof *slots);
+	if (!slots) return NULL;
+	slot_pool.slab = slots;
+	slot_pool.mused = 0;
+	slot_pool.nslab += 1;
+	}
+    slots = &slot_pool.slab[slot_pool.mused];
+    slot_pool.mused += nslot;
+    slot_pool.ninuse[nslot] += 1;
+    return (TREE **) slots;
+}
+
+STATIC void slots_free(TREE **slots, unsigned nslot)
+{
+    union slotfree *this;
+
+    if (!slots) return;
+    if (nslot > SLOT_CLASS_MAX) {
+	free (slots);
+	slot_pool.nbig -= 1;
+	return;
+	}
+    this = (union slotfree *) slots;
+    this->next = slot_pool.freelist[nslot];
+    slot_pool.freelist[nslot] = this;
+    slot_pool.nfree[nslot] += 1;
+    slot_pool.ninuse[nslot] -= 1;
+}
+
+#else /* WANT_OLD_NODES */
+
+#if WANT_SHARED_GRAMS
+	/* Take a node from the table: the unused half of twin's gram, which keeps
+	** the gram's count and stamp, or (twin == NULL) half 'half' of a new gram.
+	*/
+STATIC TREE *gram_alloc(TREE *twin, unsigned half)
+{
+    struct gram *gram;
+    TREE *node;
+    NodeNum num;
+
+    if (twin) {
+	node = NODE_TWIN(twin);
+	if (node->num != NODE_NUM_NIL) return NULL;
+	node->num = twin->num ^ 1;
+	node_tab.ninuse += 1;
+	node_tab.npaired += 1;
+	return node;
+	}
+    num = node_tab.freelist;
+    if (num != NODE_NUM_NIL) {
+	gram = GRAM_PTR(num);
+	node_tab.freelist = gram->half[0].next;
+	node_tab.nfree -= 1;
+	}
+    else {
+	num = node_tab.mused;
+	if ((num >> (NODE_CHUNK_SHIFT+1)) >= node_tab.nchunk) {
+		/* The last chunk is never used, to keep NODE_NUM_NIL out of the table */
+	    if (node_tab.nchunk >= NODE_CHUNK_MAX-1) return NULL;
+	    gram = region_alloc (NODE_CHUNK_SIZE * sizeof *gram);
+	    if (!gram) return NULL;
+	    node_tab.chunk[node_tab.nchunk++] = gram;
+	    }
+	node_tab.mused += 2;
+	gram = GRAM_PTR(num);
+	}
+    gram->half[0].num = gram->half[1].num = NODE_NUM_NIL;
+    node = &gram->half[half];
+    node->num = num + half;
+    node_tab.ninuse += 1;
+    return node;
+}
+
+STATIC TREE *node_alloc(void)
+{
+    return gram_alloc(NULL, 0);
+}
+
+	/* The forward node for words[0...len-1], if there is one */
+STATIC TREE *gram_find(const WordNum *words, unsigned len)
+{
+    TREE *node;
+    unsigned idx;
+
+    if (node_tab.roots == NODE_NUM_NIL) return NULL;
+    node = NODE_PTR(node_tab.roots);
+    if (node->num == NODE_NUM_NIL) return NULL;
+    for (idx = 0; node && idx < len; idx++) node = find_symbol(node, words[idx]);
+    return node;
+}
+
+	/* The twin of a backward parent's child symbol: the forward node for the same words.
+	** Those are the child's path read backwards, so walking up from the child gives them in order.
+	*/
+STATIC TREE *gram_twin(TREE *parent, WordNum symbol)
+{
+    WordNum words[GRAM_DEPTH_MAX];
+    unsigned len;
+
+    words[0] = symbol;
+    for (len = 1; parent->parent != NODE_NUM_NIL; parent = NODE_PTR(parent->parent)) {
+	if (len >= GRAM_DEPTH_MAX) return NULL;
+	words[len++] = parent->symbol;
+	}
+    return gram_find(words, len);
+}
+
+	/* Like node_new(), for half 'half': twin's other half, if there is a twin */
+STATIC TREE *node_new_half(TREE *twin, unsigned half)
+{
+    TREE *node;
+
+    node = gram_alloc(twin, half);
+    if (!node) {
+	error("node_new_half", "Unable to allocate the node.");
+	return NULL;
+    }
+    node->symbol = WORD_ERR;
+    NODE_SET_CHILDSUM(node, 0);
+    if (!twin) {
+	NODE_SET_VALUE(node, 0);
+	NODE_SET_STAMP(node, stamp_max);
+	}
+    node->branch = 0;
+#if WANT_SUFFIX_LINKS
+    node->suffix = NULL;
+#endif
+    node->parent = NODE_NUM_NIL;
+    node->link = NODE_NUM_NIL;
+    node->kids = NODE_NUM_NIL;
+    node->next = NODE_NUM_NIL;
+    memstats.node_cnt += 1;
+    memstats.alloc += 1;
+    return node;
+}
+
+	/* A new child for parent (which it does not adopt yet).
+	** A backward node joins its twin (if any) if that has the count it is going to get.
+	*/
+STATIC TREE *node_new_child(TREE *parent, TREE *twin, WordNum symbol, UsageCnt value)
+{
+    TREE *node;
+
+    if (!GRAM_HALF(parent)) twin = NULL;
+    if (twin && (NODE_TWIN(twin)->num != NODE_NUM_NIL || NODE_VALUE(twin) != value)) twin = NULL;
+    node = node_new_half(twin, GRAM_HALF(parent));
+    if (node) node->symbol = symbol;
+    return node;
+}
+#else
+STATIC TREE *node_alloc(void)
+{
+    TREE *node;
+    NodeNum num;
+
+    num = node_tab.freelist;
+    if (num != NODE_NUM_NIL) {
+	node = NODE_PTR(num);
+	node_tab.freelist = node->next;
+	node_tab.nfree -= 1;
+	}
+    else {
+	num = node_tab.mused;
+	if ((num >> NODE_CHUNK_SHIFT) >= node_tab.nchunk) {
+		/* The last chunk is never used, to keep NODE_NUM_NIL out of the table */
+	    if (node_tab.nchunk >= NODE_CHUNK_MAX-1) return NULL;
+	    node = region_alloc (NODE_CHUNK_SIZE * sizeof *node);
+	    if (!node) return NULL;
+	    node_tab.chunk[node_tab.nchunk++] = node;
+	    }
+	node_tab.mused += 1;
+	node = NODE_PTR(num);
+	}
+    node->num = num;
+    node_tab.ninuse += 1;
+    return node;
+}
+#endif /* WANT_SHARED_GRAMS */
+
+	/* Release the node, and remove it from the hash.
+	** The caller is responsible for the parent's sibling list and ->branch .
+	*/
+STATIC void node_free(TREE *node)
+{
+    NodeNum *np;
+#if WANT_SHARED_GRAMS
+    NodeNum num;
+#endif
+
+    if (!node) return;
+    if (node->parent != NODE_NUM_NIL) {
+	for (np = &node_tab.hash[ node_hash(node->parent, node->symbol) ]; *np != NODE_NUM_NIL; np = &NODE_PTR(*np)->link) {
+	    if (*np != node->num) continue;
+	    *np = node->link;
+	    node_tab.hused -= 1;
+	    break;
+	    }
+	}
+#if WANT_SHARED_GRAMS
+	/* The gram goes on the freelist when its other half is unused, too */
+    num = node->num & ~1u;
+    node->num = NODE_NUM_NIL;
+    node_tab.ninuse -= 1;
+    if (NODE_PTR(num)->num != NODE_NUM_NIL || NODE_PTR(num+1)->num != NODE_NUM_NIL) {
+	node_tab.npaired -= 1;
+	return;
+	}
+    GRAM_PTR(num)->half[0].next = node_tab.freelist;
+    node_tab.freelist = num;
+    node_tab.nfree += 1;
+#else
+    node->next = node_tab.freelist;
+    node_tab.freelist = node->num;
+    node->num = NODE_NUM_NIL;
+    node_tab.nfree += 1;
+    node_tab.ninuse -= 1;
+#endif
+}
+
+	/* Link child into the hash, and into node's sibling list, after prev.
+	** prev == NULL puts it in front.
+	*/
+STATIC void node_adopt(TREE *node, TREE *child, TREE *prev)
+{
+    unsigned slot;
+
+    if (!node_tab.hash || (node_tab.hused >= (1ul << node_tab.hbits) && node_tab.hbits < 31)) {
+	(void) node_hash_resize(node_tab.hbits ? node_tab.hbits+1 : NODE_HASH_BITS_INITIAL);
+	}
+    if (!node_tab.hash) {
+	error("node_adopt", "No hash table");
+	return;
+	}
+    child->parent = node->num;
+    slot = node_hash(node->num, child->symbol);
+    child->link = node_tab.hash[slot];
+    node_tab.hash[slot] = child->num;
+    node_tab.hused += 1;
+
+    if (prev) { child->next = prev->next; prev->next = child->num; }
+    else { child->next = node->kids; node->kids = child->num; }
+    node->branch += 1;
+}
+
+STATIC TREE *node_child_nth(TREE *node, ChildIndex nth)
+{
+    NodeNum num;
+
+    for (num = node->kids; num != NODE_NUM_NIL; num = NODE_PTR(num)->next) {
+	if (!nth--) return NODE_PTR(num);
+	}
+    return NULL;
+}
+
+	/* Roots are ordinary nodes here: their children are in the global hash anyway */
+STATIC TREE *node_new_root(unsigned nchild)
+{
+#if WANT_SHARED_GRAMS
+    TREE *root;
+
+	/* Roots come in pairs, forward first: the backward root is the forward root's twin */
+    root = node_tab.roots == NODE_NUM_NIL ? NULL : NODE_PTR(node_tab.roots);
+    if (root && root->num != NODE_NUM_NIL && NODE_TWIN(root)->num == NODE_NUM_NIL) {
+	return node_new_half(root, 1);
+	}
+    root = node_new(nchild);
+    node_tab.roots = root ? root->num : NODE_NUM_NIL;
+    return root;
+#else
+    return node_new(nchild);
+#endif
+}
+	/* The node table is addressed by number; relayout would mean renumbering */
+STATIC void model_relayout(MODEL *model)
+{
+    if (!model) return;
+    status("Relayout: not supported by the flat engine\n");
+}
+
+#if WANT_DICT_GC
+	/* Nodes have no index of their own: model_compact() rehashes the whole table */
+STATIC void node_rehash(TREE *node)
+{
+    (void) node;
+}
+#endif
+#endif /* WANT_OLD_NODES */
+
+#if WANT_DICT_GC
+	/* Mark the symbols that occur in the tree: map[symbol] is set to 0.
+	** Returns the number of symbols that are not in the dict (there should be none).
+	*/
+STATIC unsigned long tree_mark_symbols(TREE *node, WordNum *map, WordNum mused)
+{
+    ChildIndex cidx;
+    unsigned long nbad = 0;
+
+    if (!node) return 0;
+    if (node->symbol < mused) map[node->symbol] = 0;
+    else nbad++;
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(node)) {
+	for (cidx = 0; cidx < RUN_LEN(node); cidx++) {
+		if (RUN_SYM(node, cidx) < mused) map[ RUN_SYM(node, cidx) ] = 0;
+		else nbad++;
+		}
+	return nbad;
+	}
+#endif
+    for (cidx = CHILD_FIRST(node); cidx != CHILD_NIL; cidx = CHILD_NEXT(node, cidx)) {
+	nbad += tree_mark_symbols(CHILD_PTR(node, cidx), map, mused);
+	}
+    return nbad;
+}
+
+	/* Replace every symbol in the tree by map[symbol], and fix up the child indexes */
+STATIC void tree_renumber(TREE *node, WordNum *map)
+{
+    ChildIndex cidx;
+
+    if (!node) return;
+    node->symbol = map[node->symbol];
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(node)) {
+	for (cidx = 0; cidx < RUN_LEN(node); cidx++) RUN_SYM(node, cidx) = map[ RUN_SYM(node, cidx) ];
+	return;
+	}
+#endif
+    for (cidx = CHILD_FIRST(node); cidx != CHILD_NIL; cidx = CHILD_NEXT(node, cidx)) {
+	tree_renumber(CHILD_PTR(node, cidx), map);
+	}
+    node_rehash(node);
+}
+
+#if WANT_DICT_SORT
+	/* Descending valuesum; equal ones keep their order */
+STATIC int symbolrank_cmp(const void *vl, const void *vr)
+{
+const struct symbolrank *sl=vl, *sr=vr;
+
+if (sl->valuesum > sr->valuesum) return -1;
+if (sl->valuesum < sr->valuesum) return 1;
+if (sl->symbol < sr->symbol) return -1;
+if (sl->symbol > sr->symbol) return 1;
+return 0;
+}
+#endif
+
+	/* Drop the words that no longer occur in the trees, if at least percent% of them are garbage,
+	** and (WANT_DICT_SORT) put the words in frequency order, if they are not.
+	** With percent == 0, it does both unconditionally; otherwise it only sorts
+	** when enough hot words are misplaced (see DICT_SORT_PERCENT).
+	** The children keep their order; only the child indexes are rebuilt.
+	** The dict is rebuilt from scratch (and recounted); the crosstab, whose keys are symbols,
+	** is emptied. Returns the number of words that were dropped or got another symbol.
+	*/
+STATIC unsigned model_compact(MODEL *model, unsigned percent)
+{
+    DICT *old, *new;
+    WordNum *map, symbol, nlive;
+    struct symbolrank *rank;
+    unsigned long nbad, nmoved;
+#if WANT_DICT_SORT
+    unsigned long nhot, nmisplaced;
+#endif
+    int sorted;
+
+    if (!model || !model->dict || !model->forward || !model->backward) return 0;
+	/* a frozen brain is never saved */
+    if (frozen) return 0;
+    old = model->dict;
+    if (old->mused < 2) return 0;
+    map = malloc(old->mused * sizeof *map);
+    rank = malloc(old->mused * sizeof *rank);
+    if (!map || !rank) {
+	warn("model_compact", "Unable to allocate the map: %u words", (unsigned) old->mused);
+	free(map);
+	free(rank);
+	return 0;
+	}
+    for (symbol = 0; symbol < old->mused; symbol++) map[symbol] = WORD_NIL;
+    map[0] = map[1] = 0;
+    nbad = tree_mark_symbols(model->forward, map, old->mused);
+    nbad += tree_mark_symbols(model->backward, map, old->mused);
+    if (nbad) {
+	warn("model_compact", "%lu symbols are not in the dict (%u words); not compacted", nbad, (unsigned) old->mused);
+	goto skip;
+	}
+	/* <ERROR> and <FIN> stay in front */
+    sorted = 1;
+    for (nlive = symbol = 0; symbol < old->mused; symbol++) {
+	if (map[symbol] == WORD_NIL) continue;
+	rank[nlive].symbol = symbol;
+	rank[nlive].valuesum = symbol < 2 ? 0 : old->entry[symbol].stats.valuesum;
+	if (nlive > 2 && rank[nlive].valuesum > rank[nlive-1].valuesum) sorted = 0;
+	nlive++;
+	}
+#if !WANT_DICT_SORT
+    sorted = 1;
+#endif
+    if (nlive == old->mused && sorted) goto skip;
+#if WANT_DICT_SORT
+    if (!sorted) {
+	qsort(rank + 2, nlive - 2, sizeof *rank, symbolrank_cmp);
+	/* A hot word is misplaced if its symbol lies outside the hot range */
+	nhot = (nlive - 2) / 4 < DICT_SORT_HOT ? (nlive - 2) / 4 : DICT_SORT_HOT;
+	for (nmisplaced = 0, symbol = 2; symbol < 2 + nhot; symbol++) {
+		if (rank[symbol].symbol >= 2 + nhot) nmisplaced++;
+		}
+	if (percent && nmisplaced * 100 < (unsigned long) DICT_SORT_PERCENT * nhot) sorted = 1;
+	}
+#endif
+    if (sorted && (unsigned long) (old->mused - nlive) * 100 < (unsigned long) percent * old->mused) goto skip;
+
+    new = new_dict();
+    if (!new) goto skip;
+    for (nmoved = old->mused - nlive, symbol = 0; symbol < nlive; symbol++) {
+	map[ rank[symbol].symbol ] = add_word_dodup(new, old->entry[ rank[symbol].symbol ].string);
+	if (map[ rank[symbol].symbol ] != symbol) break;
+	if (rank[symbol].symbol != symbol) nmoved++;
+	}
+    if (symbol < nlive) {
+	warn("model_compact", "Unable to rebuild the dict at %u/%u words", (unsigned) symbol, (unsigned) nlive);
+	free_dict(new);
+	goto skip;
+	}
+    free(rank);
+
+    tree_renumber(model->forward, map);
+    tree_renumber(model->backward, map);
+#if !WANT_OLD_NODES
+    if (node_tab.hash) (void) node_hash_resize(node_tab.hbits);
+#endif
+    free(map);
+
+    nbad = old->mused - nlive;
+    model->dict = new;
+    free_dict(old);
+    set_dict_count(model);
+    memstats.word_cnt = new->mused;
+	/* The crosstab's keys are symbols: start a new one, of the same size (if it has one) */
+    if (glob_crosstab) {
+	unsigned xsize = glob_crosstab->msize;
+	crosstab_free(glob_crosstab);
+	glob_crosstab = xsize ? crosstab_init(xsize) : NULL;
+	}
+    status("Compact: %u words kept, %lu dropped, %lu renumbered\n", (unsigned) new->mused, nbad, nmoved - nbad);
+    return nmoved;
+
+skip:
+    free(rank);
+    free(map);
+    return 0;
+}
+#endif /* WANT_DICT_GC */
+
+/*---------------------------------------------------------------------------*/
+
+STATIC MODEL *new_model(int order)
+{
+    MODEL *model = NULL;
+
+    model = malloc(sizeof *model);
+    if (!model) {
+	error("new_model", "Unable to allocate model.");
+        return NULL;
+    }
+
+    model->order = order;
+    model->forward = node_new_root(0);
+    model->backward = node_new_root(0);
+    model->context = malloc( (2+order) *sizeof *model->context);
+    if (!model->context) {
+	error("new_model", "Unable to allocate context array.");
+        return NULL;
+    }
+#if WANT_PATH_COMPRESSION
+    model->view = malloc( (2+order) *sizeof *model->view);
+    if (!model->view) {
+	error("new_model", "Unable to allocate view array.");
+        return NULL;
+    }
+#endif
+    initialize_context(model);
+    model->dict = new_dict();
+    initialize_dict(model->dict);
+
+    return model;
+}
+
+/*---------------------------------------------------------------------------*/
+
+STATIC void update_model(MODEL *model, WordNum symbol)
+{
+    unsigned int iord;
+    TREE *node;
+#if WANT_SUFFIX_LINKS
+    TREE *above = NULL;
+#endif
+	/* this is a bit defensive; these symbols should never occur */
+    if (symbol == WORD_NIL) return;
+    if (symbol == WORD_ERR) return;
+    /*
+     *	Update all of the models in the current context with the specified
+     *	symbol.
+     */
+#if WANT_PREFETCH && !WANT_SUFFIX_LINKS
+	/* With suffix links, only the top order does a real lookup (or add). */
+    for(iord = model->order+1; iord > 0; iord--) {
+	if (model->context[iord-1]) node_prefetch(model->context[iord-1], symbol);
+	}
+#endif
+    for(iord = model->order+1; iord > 0; iord--) {
+#if WANT_SUFFIX_LINKS
+	if ( !model->context[iord-1] ) { above = NULL; continue; }
+	node = above ? above->suffix : NULL;
+	if (node && node->symbol == symbol) node = add_symbol_node(model->context[iord-1], node);
+	else	{
+		node = add_symbol(model->context[iord-1], symbol);
+		if (above) above->suffix = node;
+		}
+	above = node;
+#else
+	if ( !model->context[iord-1] ) continue;
+	node = add_symbol(model->context[iord-1], symbol);
+#endif
+	model->context[iord] = node;
+	dict_inc_ref_node(model->dict, model->context[iord], symbol);
+	}
+
+    return;
+}
+
+/*---------------------------------------------------------------------------*/
+
+STATIC void update_context(MODEL *model, WordNum symbol)
+{
+    unsigned int iord;
+    TREE *node;
+#if WANT_SUFFIX_LINKS
+    TREE *above = NULL;
+#endif
+
+#if WANT_PREFETCH && !WANT_SUFFIX_LINKS
+	/* With suffix links, only the top order does a real lookup. */
+    for(iord = model->order+1; iord > 0; iord--) {
+	if (model->context[iord-1]) node_prefetch(model->context[iord-1], symbol);
+	}
+#endif
+    for(iord = model->order+1; iord > 0; iord--) {
+#if WANT_SUFFIX_LINKS
+	if ( !model->context[iord-1] ) { above = NULL; continue; }
+	node = above ? above->suffix : NULL;
+	if (!node || node->symbol != symbol) {
+		node = FIND_SYMBOL_VIEW(model, model->context[iord-1], symbol, iord);
+			/* never link to a view */
+		if (above && !NODE_IS_VIEW(model, node)) above->suffix = node;
+		}
+	above = node;
+#else
+	if ( !model->context[iord-1] ) continue;
+	node = FIND_SYMBOL_VIEW(model, model->context[iord-1], symbol, iord);
+#endif
+	model->context[iord] = node;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *	Update the statistics of the specified tree with the
+ *	specified symbol, which may mean growing the tree if the
+ *	symbol hasn't been seen in this context before.
+ */
+STATIC TREE *add_symbol(TREE *tree, WordNum symbol)
+{
+    TREE *node = NULL;
+
+    node = find_symbol_add(tree, symbol);
+    if (!node) return NULL;
+    return add_symbol_node(tree, node);
+}
+
+	/* Count one more occurrence of child node in tree */
+STATIC TREE *add_symbol_node(TREE *tree, TREE *node)
+{
+    /*
+     *		Increment the symbol counts
+     *		Stop incrementing when wraparound detected.
+     */
+    /* fprintf(stderr, "Add_symbol(%u: Parent=%u->%u Child=%u->%u)\n"
+	, symbol, tree->symbol, tree->childsum, node->symbol, node->thevalue);
+	 */
+    NODE_SET_STAMP(node, stamp_max); NODE_SET_STAMP(tree, stamp_max);
+#if WANT_SHARED_GRAMS
+	/* A backward node that has its twin was counted by the forward pass */
+    if (!GRAM_HALF(node) || NODE_TWIN(node)->num == NODE_NUM_NIL)
+#endif
+    NODE_SET_VALUE(node, NODE_VALUE(node) + 1);
+    NODE_SET_CHILDSUM(tree, NODE_CHILDSUM(tree) + 1);
+    if (!NODE_VALUE(node)) {
+	warn("add_symbol", "Count wants to wrap");
+	NODE_SET_VALUE(node, NODE_VALUE(node) - 1);
+    }
+    if (!NODE_CHILDSUM(tree)) {
+	warn("add_symbol", "Usage wants to wrap");
+	NODE_SET_CHILDSUM(tree, NODE_CHILDSUM(tree) - 1);
+    }
+#if WANT_SORTED_CHILDREN
+    node_promote(tree, node);
+#endif
+#if WANT_SAMPLERS
+    if (tree->branch >= SAMPLER_FANOUT) sampler_drop(tree);
+#endif
+
+    glob_dirt += 1;
+    return node;
+}
+
+STATIC void dump_model(MODEL * model, char *path, int flags)
+{
+FILE *fp;
+
+fp = fopen (path , "w" );
+if (!fp) return;
+
+fprintf(fp, "[ stamp Min=%u Max=%u ]\n", (unsigned)stamp_min, (unsigned)stamp_max);
+if (frozen) {
+	fprintf(fp, "Frozen: not dumped\n");
+	fclose(fp);
+	return;
+	}
+
+if (flags & 1) {
+	fprintf(fp, "->forward Order=%u\n", (unsigned) model->order);
+	dump_model_recursive(fp, model->forward, model->dict, 0);
+	}
+
+if (flags & 2) {
+	fprintf(fp, "->backward Order=%u\n", (unsigned) model->order);
+	dump_model_recursive(fp, model->backward, model->dict, 0);
+	}
+fprintf(fp, "->Eof\n" );
+fclose (fp);
+}
+
+STATIC void dump_model_recursive(FILE *fp, TREE *tree, DICT *dict, int indent)
+{
+unsigned slot;
+ChildIndex cidx;
+WordNum sym;
+static STRING null = {0,0,0,""};
+unsigned nnode=0,valuesum=0;
+STRING str;
+if (!tree) return;
+
+sym = tree->symbol;
+if (sym < dict->mused){
+	str = dict->entry[sym].string ;
+	nnode = dict->entry[sym].stats.nnode;
+	valuesum = dict->entry[sym].stats.valuesum;
+	}
+else	{
+	str = null;
+	}
+
+for (slot = 0; slot < indent; slot++) {
+	fputc(' ', fp);
+	}
+
+fprintf(fp, "Va=%u Su=%u St=%u Br=%u/%u Sym=%u [%u,%u] '%*.*s'\n"
+	, NODE_VALUE(tree)
+	, NODE_CHILDSUM(tree)
+	, NODE_STAMP(tree)
+#if WANT_OLD_NODES
+	, tree->branch, NODE_MSIZE(tree) , tree->symbol
+#else
+	, tree->branch, tree->branch , tree->symbol
+#endif
+	, valuesum, nnode
+	, (int) str.length , (int) str.length , str.word
+	);
+
+#if WANT_PATH_COMPRESSION
+if (NODE_IS_RUN(tree)) {
+	for (cidx = 0; cidx < RUN_LEN(tree); cidx++) {
+		sym = RUN_SYM(tree, cidx);
+		str = (sym < dict->mused) ? dict->entry[sym].string : null;
+		for (slot = 0; slot <= indent+cidx; slot++) {
+			fputc(' ', fp);
+			}
+		fprintf(fp, "Va=1 Su=%u St=%u Br=%u/run Sym=%u '%*.*s'\n"
+			, (cidx+1 < RUN_LEN(tree)) ? 1 : 0
+			, RUN_STAMP(tree)
+			, (cidx+1 < RUN_LEN(tree)) ? 1 : 0
+			, sym
+			, (int) str.length , (int) str.length , str.word
+			);
+		}
+	return;
+	}
+#endif
+for (cidx = CHILD_FIRST(tree); cidx != CHILD_NIL; cidx = CHILD_NEXT(tree, cidx)) {
+	dump_model_recursive(fp, CHILD_PTR(tree, cidx) , dict, indent+1);
+	}
+
+return;
+}
+
+#if WANT_OLD_NODES
+/* Delete a symbol from a node.
+** The node's statistics are updated (but NOT it's parent's summary statistics!!)
+** The node is compacted by shifting the highest element into the vacated slot.
+** The node's children-array is NOT (yet) reallocated.
+** (unless it has shrunk enough to fit inline)
+*/
+STATIC void del_symbol_do_free(TREE *tree, WordNum symbol)
+{
+    ChildIndex bucket, this,top;
+    TREE *child = NULL;
+
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(tree) && node_unrun(tree)) return;
+#endif
+    /*
+     *		Search for the symbol in the subtree of the tree node.
+     */
+    if (NODE_IS_INLINE(tree)) {
+	this = node_find_inline(tree, symbol);
+	if (this == CHILD_NIL) {
+	    warn("Del_symbol_do_free", "Symbol %u not found\n", symbol);
+	    return ;
+	    }
+	child = tree->u.kids[this];
+	}
+    else if (NODE_IS_DENSE(tree)) {
+	if (symbol >= ROOT_INDEX(tree)->ssize || ROOT_INDEX(tree)->sidx[symbol] == CHILD_NIL) {
+	    warn("Del_symbol_do_free", "Symbol %u not found\n", symbol);
+	    return ;
+	    }
+	this = ROOT_INDEX(tree)->sidx[symbol];
+	ROOT_INDEX(tree)->sidx[symbol] = CHILD_NIL;
+	child = tree->u.children[this] ;
+	}
+    else {
+	bucket = node_hnd(tree, symbol);
+	if (bucket == CHILD_NIL || CHILD_HIDX(tree)[bucket] == CHILD_NIL) {
+	    warn("Del_symbol_do_free", "Symbol %u not found\n", symbol);
+	    return ;
+	    }
+	/* cut the node out of the hash table; save the child. */
+	this = CHILD_HIDX(tree)[bucket];
+	node_unhash(tree, bucket);
+	child = tree->u.children[this] ;
+	}
+
+    /*
+     *		Decrement the symbol counts
+     *		Avoid wrapping.
+     */
+    if (!NODE_CHILDSUM(tree)) {
+	warn("del_symbol_do_free", "Usage already zero\n");
+    }
+    if (NODE_CHILDSUM(tree) < NODE_VALUE(child)) {
+	warn("del_symbol_do_free", "Usage (%u -= %u) would drop below zero\n", NODE_CHILDSUM(tree), NODE_VALUE(child) );
+	NODE_SET_VALUE(child, NODE_CHILDSUM(tree));
+    }
+    NODE_SET_CHILDSUM(tree, NODE_CHILDSUM(tree) - NODE_VALUE(child));
+
+    /* FIXME: we should also decrement the refcounts for the corresponding dict-entry.
+    ** (but that would require access to the model->dict, and we should avoid the risk
+    ** of creating stale pointers in model->context[order]
+    */
+    if (!tree->branch) {
+	warn("del_symbol_do_free", "Branching already zero");
+	goto kill;
+    }
+    top = --tree->branch;
+    memstats.symdel += 1;
+#if WANT_SAMPLERS
+    sampler_drop(tree);
+#endif
+#if WANT_SORTED_CHILDREN
+	/* shift the ones above it down, to keep them sorted */
+    if (NODE_IS_INLINE(tree)) {
+	for ( ; this < top; this++) tree->u.kids[this] = tree->u.kids[this+1];
+	tree->u.kids[top] = NULL;
+	}
+    else {
+	for ( ; this < top; this++) {
+		tree->u.children[this] = tree->u.children[this+1];
+		node_reindex(tree, this);
+		}
+	tree->u.children[top] = NULL;
+	}
+#else
+    if (NODE_IS_INLINE(tree)) {
+	tree->u.kids[this] = tree->u.kids[top];
+	tree->u.kids[top] = NULL;
+	}
+    else if ( !top || top == this) { tree->u.children[this] = NULL; }
+    else if (NODE_IS_DENSE(tree)) {
+	tree->u.children[this] = tree->u.children[top];
+	tree->u.children[top] = NULL;
+	ROOT_INDEX(tree)->sidx[ tree->u.children[this]->symbol ] = this;
+	}
+    else {
+	/* move top into the vacated slot, and repoint its bucket */
+	tree->u.children[this] = tree->u.children[top];
+	tree->u.children[top] = NULL;
+	bucket = node_hnd(tree, tree->u.children[this]->symbol);
+	CHILD_HIDX(tree)[bucket] = this;
+	}
+#endif
+
+	/* now this child needs to be abolished ... */
+kill:
+    free_tree_recursively(child);
+    memstats.treedel += 1;
+    /* fprintf(stderr, "Freed_tree() node_count now=%u treedel = %u\n",  memstats.node_cnt, memstats.treedel ); */
+    if (!NODE_IS_INLINE(tree) && !NODE_IS_DENSE(tree)
+	&& (tree->branch <= NODE_INLINE_MAX || tree->branch < NODE_MSIZE(tree) >> (CHILD_GROW_SHIFT+1))) {
+#if (WANT_DUMP_ALZHEIMER_PROGRESS >= 2)
+	status("Tree(%u/%u) will be shrunk: %u/%u\n"
+		, NODE_VALUE(tree), NODE_CHILDSUM(tree), tree->branch, NODE_MSIZE(tree));
+#endif
+		resize_tree(tree, tree->branch);
+		}
+}
+#else /* WANT_OLD_NODES */
+
+/* Delete a symbol from a node.
+** The node's statistics are updated (but NOT it's parent's summary statistics!!)
+** The child is cut out of the sibling list here, and out of the hash by node_free().
+** Finding the predecessor in the sibling list costs a linear walk.
+*/
+STATIC void del_symbol_do_free(TREE *tree, WordNum symbol)
+{
+    NodeNum *np;
+    TREE *child = NULL;
+
+    np = node_hash_hnd(tree, symbol);
+    if (!np || *np == NODE_NUM_NIL) {
+	warn("Del_symbol_do_free", "Symbol %u not found\n", symbol);
+	return ;
+	}
+    child = NODE_PTR(*np);
+    for (np = &tree->kids; *np != NODE_NUM_NIL; np = &NODE_PTR(*np)->next) {
+	if (*np != child->num) continue;
+	*np = child->next;
+	break;
+	}
+
+    if (!NODE_CHILDSUM(tree)) {
+	warn("del_symbol_do_free", "Usage already zero\n");
+    }
+    if (NODE_CHILDSUM(tree) < NODE_VALUE(child)) {
+	warn("del_symbol_do_free", "Usage (%u -= %u) would drop below zero\n", NODE_CHILDSUM(tree), NODE_VALUE(child) );
+	NODE_SET_VALUE(child, NODE_CHILDSUM(tree));
+    }
+    NODE_SET_CHILDSUM(tree, NODE_CHILDSUM(tree) - NODE_VALUE(child));
+
+    if (!tree->branch) {
+	warn("del_symbol_do_free", "Branching already zero");
+    }
+    else {
+	tree->branch -= 1;
+	memstats.symdel += 1;
+	}
+
+    free_tree_recursively(child);
+    memstats.treedel += 1;
+}
+#endif /* WANT_OLD_NODES */
+
+void free_tree_recursively(TREE *tree)
+{
+ChildIndex index, next;
+
+if (!tree) return;
+
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(tree)) {
+	for (index = 0; index < RUN_LEN(tree); index++) {
+		(void) dict_dec_ref(alz_dict, RUN_SYM(tree, index), 1, 1);
+		}
+	memstats.node_cnt -= RUN_LEN(tree);
+	memstats.free += RUN_LEN(tree);
+	}
+    else
+#endif
+    for (index = CHILD_REAP_FIRST(tree); index != CHILD_NIL; index = next) {
+        next = CHILD_REAP_NEXT(tree, index);
+        free_tree_recursively( CHILD_PTR(tree, index) );
+        }
+    (void) dict_dec_ref(alz_dict, tree->symbol, 1, NODE_VALUE(tree));
+    node_free(tree);
+    memstats.node_cnt -= 1;
+    memstats.free += 1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+#if WANT_PATH_COMPRESSION
+	/* Like find_symbol(), but a node inside a run is not split off.
+	** Instead, view is filled in to describe it, and returned.
+	** The view points into the run, so it is only valid until the tree is modified.
+	*/
+STATIC TREE *find_symbol_view(TREE *node, WordNum symbol, TREE *view)
+{
+unsigned len;
+
+#if WANT_FROZEN
+if (NODE_IS_FROZEN(node)) return frozen_find(node, symbol, view);
+#endif
+if (!NODE_IS_RUN(node)) return find_symbol(node, symbol);
+if (RUN_SYM(node, 0) != symbol) return NULL;
+
+len = RUN_LEN(node);
+view->symbol = symbol;
+NODE_SET_VALUE(view, 1);
+NODE_SET_STAMP(view, RUN_STAMP(node));
+#if WANT_SUFFIX_LINKS
+view->suffix = NULL;
+#endif
+if (len > 1) {
+	NODE_SET_MSIZE(view, CHILD_RUN(len-1));
+	view->u.run = node->u.run + 1;
+	view->branch = 1;
+	NODE_SET_CHILDSUM(view, 1);
+	}
+else	{
+	NODE_SET_MSIZE(view, 0);
+	view->u.kids[0] = NULL;
+	view->branch = 0;
+	NODE_SET_CHILDSUM(view, 0);
+	}
+return view;
+}
+#endif /* WANT_PATH_COMPRESSION */
+
+#if WANT_OLD_NODES
+STATIC TREE *find_symbol(TREE *node, WordNum symbol)
+{
+ChildIndex bucket;
+
+#if WANT_PATH_COMPRESSION
+if (NODE_IS_RUN(node)) {
+	if (RUN_SYM(node, 0) != symbol || node_unrun(node)) return NULL;
+	return node->u.kids[0];
+	}
+#endif
+if (NODE_IS_INLINE(node)) {
+	ChildIndex cidx;
+	cidx = node_find_inline(node, symbol);
+	return (cidx == CHILD_NIL) ? NULL : node->u.kids[cidx];
+	}
+if (NODE_IS_DENSE(node)) {
+	struct rootindex *ri = ROOT_INDEX(node);
+	if (symbol >= ri->ssize || ri->sidx[symbol] == CHILD_NIL) return NULL;
+	return node->u.children[ ri->sidx[symbol] ];
+	}
+bucket = node_hnd(node, symbol);
+if (bucket == CHILD_NIL || CHILD_HIDX(node)[bucket] == CHILD_NIL) return NULL;
+
+return node->u.children[ CHILD_HIDX(node)[bucket] ] ;
+}
+
+/*---------------------------------------------------------------------------*/
+
+#if WANT_PREFETCH
+	/* Start loading what find_symbol(node, symbol) is going to read (see WANT_PREFETCH) */
+STATIC void node_prefetch(TREE *node, WordNum symbol)
+{
+unsigned slot;
+ChildIndex cidx;
+
+#if WANT_PATH_COMPRESSION
+if (NODE_IS_RUN(node)) { PREFETCH(node->u.run); return; }
+#endif
+#if WANT_FROZEN
+if (NODE_IS_FROZEN(node)) {
+	struct frozenlevel *lev;
+	unsigned lnum;
+	if (!node->branch) return;
+		/* frozen_find()'s first probe */
+	lnum = frozen_level(node->u.fnum);
+	lev = &frozen_brain.level[lnum];
+	PREFETCH(lev->bits + (node->u.fnum - frozen_brain.lstart[lnum] + node->branch/2) * lev->width / 64);
+	return;
+	}
+#endif
+if (NODE_IS_INLINE(node)) {
+	for (cidx = 0; cidx < node->branch; cidx++) PREFETCH(node->u.kids[cidx]);
+	return;
+	}
+if (NODE_IS_DENSE(node)) {
+	struct rootindex *ri = ROOT_INDEX(node);
+	if (symbol < ri->ssize) PREFETCH(ri->sidx + symbol);
+	return;
+	}
+slot = CHILD_HASH(symbol) & (NODE_MSIZE(node) - 1);
+PREFETCH(CHILD_HSYM(node) + slot);
+PREFETCH(CHILD_HIDX(node) + slot);
+}
+#endif /* WANT_PREFETCH */
+
+/*---------------------------------------------------------------------------*/
+
+STATIC TREE *find_symbol_add(TREE *node, WordNum symbol)
+{
+ChildIndex bucket, cidx;
+
+#if WANT_PATH_COMPRESSION
+if (NODE_IS_RUN(node) && node_unrun(node)) return NULL;
+#endif
+if (NODE_IS_INLINE(node)) {
+	cidx = node_find_inline(node, symbol);
+	if (cidx != CHILD_NIL) return node->u.kids[cidx];
+	if (node->branch < NODE_INLINE_MAX) {
+		cidx = node->branch;
+		node->u.kids[cidx] = node_new(0);
+		if (!node->u.kids[cidx]) return NULL;
+		node->branch++;
+		node->u.kids[cidx]->symbol = symbol;
+		return node->u.kids[cidx];
+		}
+	/* else: fall through; the resize below will spill the inline children */
+	}
+else if (NODE_IS_DENSE(node)) {
+	TREE *child;
+	child = find_symbol(node, symbol);
+	if (child) return child;
+	child = node_new(0);
+	if (!child) return NULL;
+	child->symbol = symbol;
+	if (root_append(node, child)) {
+		node_free(child);
+		memstats.node_cnt -= 1;
+		memstats.free += 1;
+		return NULL;
+		}
+	return child;
+	}
+bucket = node_hnd(node, symbol);
+if (bucket != CHILD_NIL && CHILD_HIDX(node)[bucket] != CHILD_NIL) {
+	return node->u.children[ CHILD_HIDX(node)[bucket] ];
+	}
+
+	/* not found: create one. Keep the load factor <= CHILD_LOAD_PERCENT */
+if (NODE_IS_INLINE(node) || 100 * (node->branch+1) > CHILD_LOAD_PERCENT * NODE_MSIZE(node)) {
+	if (resize_tree(node, child_table_grow(node))) {
+		warn("Find_symbol_add", "resize failed; old=%u branch=%u symbol=%u"
+		, NODE_MSIZE(node), node->branch, symbol );
+		return NULL;
+		}
+        /* after resize the bucket is stale: need to obtain a new one */
+	bucket = node_hnd(node, symbol);
+	if (bucket == CHILD_NIL) {
+		warn("Find_symbol_add", "No bucket after resize, symbol=%u", symbol );
+		return NULL;
+		}
+	}
+cidx = node->branch;
+node->u.children[ cidx ] = node_new(0);
+if (!node->u.children[ cidx ]) return NULL;
+node->branch++;
+node->u.children[ cidx ]->symbol = symbol;
+CHILD_HSYM(node)[bucket] = symbol;
+CHILD_HIDX(node)[bucket] = cidx;
+
+return node->u.children[ cidx ] ;
+}
 
 /*
- *	Update the statistics of the specified tree with the
- *	specified symbol, which may mean growing the tree if the
- *	symbol hasn't been seen in this context before.
- */
-STATIC TREE *add_symbol(TREE *tree, WordNum symbol)
+** Resize the node's child table to hold (at least) nchild children.
+** The new size is rounded up to a power of two, or the children are put inline.
+*/
+STATIC int resize_tree(TREE *tree, unsigned nchild)
 {
-    TREE *node = NULL;
+    ChildIndex item;
+    unsigned oldsize, newsize;
+    TREE **old;
+    TREE *spill[NODE_INLINE_MAX];
 
-    node = find_symbol_add(tree, symbol);
-    if (!node) return NULL;
+    if (!tree) return -1;
+    if (NODE_IS_DENSE(tree)) return 0;
+/* fprintf(stderr, "resize_tree(%u/%u) %u\n", tree->branch,  NODE_MSIZE(tree), nchild);*/
+    if (nchild < tree->branch) nchild = tree->branch;
+
+	/* Small enough: move the children inline, and drop the table */
+    if (nchild <= NODE_INLINE_MAX) {
+	if (NODE_IS_INLINE(tree)) return 0;
+	old = tree->u.children;
+	oldsize = NODE_MSIZE(tree);
+	for (item = 0; item < tree->branch; item++) tree->u.kids[item] = old[item];
+	for ( ; item < NODE_INLINE_MAX; item++) tree->u.kids[item] = NULL;
+	NODE_SET_MSIZE(tree, 0);
+	slots_free(old, oldsize);
+	return 0;
+	}
+    newsize = child_table_size(nchild);
+    if (newsize == NODE_MSIZE(tree)) return 0;
 
-    /*
-     *		Increment the symbol counts
-     *		Stop incrementing when wraparound detected.
-     */
-    /* fprintf(stderr, "Add_symbol(%u: Parent=%u->%u Child=%u->%u)\n"
-	, symbol, tree->symbol, tree->childsum, node->symbol, node->thevalue);
-	 */
-    node->stamp = stamp_max; tree->stamp = stamp_max;
-    node->thevalue += 1; tree->childsum += 1;
-    if (!node->thevalue) {
-	warn("add_symbol", "Count wants to wrap");
-	node->thevalue -= 1;
-    }
-    if (!tree->childsum) {
-	warn("add_symbol", "Usage wants to wrap");
-	tree->childsum -= 1;
+	/* Inline children are treated as an (unhashed) old array */
+    if (NODE_IS_INLINE(tree)) {
+	for (item = 0; item < tree->branch; item++) spill[item] = tree->u.kids[item];
+	old = spill;
+	}
+    else old = tree->u.children;
+
+    tree->u.children = slots_alloc(newsize);
+    if (!tree->u.children) {
+	error("Resize_tree", "Unable to reallocate subtree.");
+	if (old == spill) {
+	    for (item = 0; item < tree->branch; item++) tree->u.kids[item] = spill[item];
+	    }
+	else tree->u.children = old;
+	return -1;
     }
+    oldsize = NODE_MSIZE(tree) ;
+    NODE_SET_MSIZE(tree, newsize);
+    format_treeslots(tree);
+#if WANT_SAMPLERS
+    sampler_drop(tree);
+#endif
+    grow_stats.child_resize += 1;
+    grow_stats.child_moved += tree->branch;
 
-    glob_dirt += 1;
-    return node;
+#if WANT_DUMP_REHASH_TREE
+	fprintf(stderr, "Old=%p:%u New=%p:%u Tree_resize(%u/%u)\n"
+	, (void*) old, oldsize
+	, (void*) tree->u.children, newsize
+	, tree->branch,  NODE_MSIZE(tree));
+#endif /* WANT_DUMP_REHASH_TREE */
+
+/* Now rebuild the hash table.
+ * The buckets have already been initialized to empty,
+ * we only have to copy the children verbatim,
+ * find the bucket for each of them, and put it there.
+ *
+ * Since we need to rebuild the hash table anyway, this is a good place to
+ * sort the items (in descending order) to make life easier for babble() .
+ * We only sort when the node is growing (newsize>oldsize), assuming ordering
+ * is more or less fixed for aged nodes. FIXME
+ */
+    if (!WANT_SORTED_CHILDREN && newsize > oldsize && tree->branch > 1) {
+#if ( WANT_DUMP_ALZHEIMER_PROGRESS >= 2 || WANT_DUMP_REHASH_TREE)
+	fprintf(stderr, "Resize:sort(Symbol=%u Cnt=%u) Old=%u New=%u Value=%u Childsum=%u\n"
+	, tree->symbol, tree->branch
+	, oldsize, newsize
+	, NODE_VALUE(tree), NODE_CHILDSUM(tree));
+#endif
+	treeslots_sort(old, tree->branch );
+	}
+
+    for (item =0 ; item < tree->branch; item++) {
+	ChildIndex bucket;
+	bucket = node_hnd(tree, old[item]->symbol);
+#if (WANT_DUMP_REHASH_TREE >= 2)
+	fprintf(stderr, "Placing Item=%u Symbol=%5u(%8x) Bucket=%u\n"
+	, (unsigned) item , (unsigned) old[item]->symbol, (unsigned) old[item]->symbol, (unsigned) bucket );
+#endif
+	CHILD_HSYM(tree)[bucket] = old[item]->symbol;
+	CHILD_HIDX(tree)[bucket] = item;
+	tree->u.children[item] = old[item];
+	}
+    if (old != spill) slots_free (old, oldsize);
+    return 0; /* success */
 }
 
-STATIC void dump_model(MODEL * model, char *path, int flags)
+	/* The smallest power of two that can hold nchild children at a load factor <= CHILD_LOAD_PERCENT */
+STATIC unsigned child_table_size(unsigned nchild)
 {
-FILE *fp;
+    unsigned size;
 
-fp = fopen (path , "w" );
-if (!fp) return;
+    for (size = 4; CHILD_LOAD_PERCENT * (unsigned long) size < 100 * (unsigned long) nchild; size *= 2) {;}
+    return size;
+}
 
-fprintf(fp, "[ stamp Min=%u Max=%u ]\n", (unsigned)stamp_min, (unsigned)stamp_max);
+	/* The number of children to resize a full child table for: one more, but at least
+	** enough to make it 1<<CHILD_GROW_SHIFT times as big.
+	*/
+STATIC unsigned child_table_grow(TREE *node)
+{
+    unsigned long nchild;
 
-if (flags & 1) {
-	fprintf(fp, "->forward Order=%u\n", (unsigned) model->order);
-	dump_model_recursive(fp, model->forward, model->dict, 0);
+    nchild = node->branch + 1;
+    if (NODE_IS_INLINE(node)) return nchild;
+    if (nchild < (CHILD_LOAD_PERCENT * ((unsigned long) NODE_MSIZE(node) << CHILD_GROW_SHIFT)) / 100)
+	nchild = (CHILD_LOAD_PERCENT * ((unsigned long) NODE_MSIZE(node) << CHILD_GROW_SHIFT)) / 100;
+    return nchild;
+}
+
+STATIC void format_treeslots(TREE *node)
+{
+    unsigned idx;
+    WordNum *hsym;
+    ChildIndex *hidx;
+
+    hsym = CHILD_HSYM(node);
+    hidx = CHILD_HIDX(node);
+    for (idx = 0; idx < NODE_MSIZE(node); idx++) {
+	node->u.children[idx] = NULL;
+	hsym[idx] = WORD_NIL;
+	hidx[idx] = CHILD_NIL;
+	}
+}
+
+
+STATIC int treeslots_cmp(const void *vl, const void *vr)
+{
+TREE * const *sl=vl;
+TREE * const *sr=vr;
+
+if ( !*sl && !*sr) return 0;
+if ( !*sl ) return 1;
+if ( !*sr ) return -1;
+
+if ( NODE_VALUE(*sl) < NODE_VALUE(*sr) ) return 1;
+if ( NODE_VALUE(*sl) > NODE_VALUE(*sr) ) return -1;
+
+if ( (*sl)->symbol < (*sr)->symbol ) return -1;
+if ( (*sl)->symbol > (*sr)->symbol ) return 1;
+return 0;
+}
+
+/* NOTE: quicksort is a bad choice here, since the childnodes are "almost sorted",
+ * The sorting does not consume enough CPU to justify a mergesort or insertion sort variant.
+ * (when training, qsort ate 10% CPU, most of it in the compare function)
+ *
+ * This is a "one pass bubblesort":
+ * It will /eventually/ get the array sorted.
+ * Having the array sorted is not that important: babble() may need only
+ * a few steps extra on an almost sorted array.
+ * treeslots_cmp(left,right) returns positive if left < right
+ * (which is the intended order)
+ *
+ * NOTE 2013-10-14 we start at the top of the array, since that is
+ * where the new entries emerge and the old ones fade away.
+ */
+
+#if 0
+STATIC void treeslots_sort(TREE **slots , unsigned count)
+{
+	qsort(slots, count, sizeof *slots, treeslots_cmp);
+}
+#else
+
+STATIC void treeslots_sort(TREE **slots , unsigned count)
+{
+unsigned idx;
+#if SORT_UP_WOULD_BE_OPTIMAL
+for (idx = 1; idx < count; idx++) {
+#else
+for (idx = count; --idx > 0; ) {
+#endif
+	TREE *tmp;
+	if (treeslots_cmp( &slots[idx-1], &slots[idx]) <= 0) continue;
+	tmp = slots[idx];
+	slots[idx] = slots[idx-1];
+	slots[idx-1] = tmp;
 	}
+}
 
-if (flags & 2) {
-	fprintf(fp, "->backward Order=%u\n", (unsigned) model->order);
-	dump_model_recursive(fp, model->backward, model->dict, 0);
+#endif
+
+#if WANT_SORTED_CHILDREN
+	/* child's count has just been incremented. If it now exceeds its predecessor's,
+	** swap it with the first child that has a lower count. (binary search: the
+	** children are sorted) Only these two children need to be reindexed.
+	*/
+STATIC void node_promote(TREE *tree, TREE *child)
+{
+    TREE **children;
+    ChildIndex this, lo, hi, mid;
+    UsageCnt value;
+
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(tree)) return;
+#endif
+    if (tree->branch < 2) return;
+    if (NODE_IS_INLINE(tree)) {
+	children = tree->u.kids;
+	this = node_find_inline(tree, child->symbol);
 	}
-fprintf(fp, "->Eof\n" );
-fclose (fp);
+    else if (NODE_IS_DENSE(tree)) {
+	children = tree->u.children;
+	this = ROOT_INDEX(tree)->sidx[child->symbol];
+	}
+    else {
+	children = tree->u.children;
+	this = CHILD_HIDX(tree)[ node_hnd(tree, child->symbol) ];
+	}
+    if (!this || this == CHILD_NIL) return;
+    value = NODE_VALUE(child);
+    if (NODE_VALUE(children[this-1]) >= value) return;
+
+    for (lo = 0, hi = this-1; lo < hi; ) {
+	mid = (lo + hi) / 2;
+	if (NODE_VALUE(children[mid]) < value) hi = mid;
+	else lo = mid + 1;
+	}
+    children[this] = children[lo];
+    children[lo] = child;
+    node_reindex(tree, this);
+    node_reindex(tree, lo);
 }
 
-STATIC void dump_model_recursive(FILE *fp, TREE *tree, DICT *dict, int indent)
+	/* Sort the children of a freshly loaded node, unless they already are */
+STATIC void node_sort_children(TREE *node)
 {
-unsigned slot;
-WordNum sym;
-static STRING null = {0,0,0,""};
-unsigned nnode=0,valuesum=0;
-STRING str;
-if (!tree) return;
+    ChildIndex cidx;
 
-sym = tree->symbol;
-if (sym < dict->mused){
-	str = dict->entry[sym].string ;
-	nnode = dict->entry[sym].stats.nnode;
-	valuesum = dict->entry[sym].stats.valuesum;
+    for (cidx = 1; cidx < node->branch; cidx++) {
+	if (NODE_VALUE(CHILD_PTR(node, cidx-1)) < NODE_VALUE(CHILD_PTR(node, cidx))) break;
 	}
-else	{
-	str = null;
+    if (cidx >= node->branch) return;
+    if (NODE_IS_INLINE(node)) {
+	qsort(node->u.kids, node->branch, sizeof *node->u.kids, treeslots_cmp);
+	return;
+	}
+    qsort(node->u.children, node->branch, sizeof *node->u.children, treeslots_cmp);
+    for (cidx = 0; cidx < node->branch; cidx++) node_reindex(node, cidx);
+}
+
+	/* Point the index entry (hash bucket or dense slot) for child cidx back at cidx */
+STATIC void node_reindex(TREE *node, ChildIndex cidx)
+{
+    if (NODE_IS_INLINE(node)) return;
+    if (NODE_IS_DENSE(node)) ROOT_INDEX(node)->sidx[ node->u.children[cidx]->symbol ] = cidx;
+    else CHILD_HIDX(node)[ node_hnd(node, node->u.children[cidx]->symbol) ] = cidx;
+}
+#endif /* WANT_SORTED_CHILDREN */
+
+#if WANT_SAMPLERS
+	/* The child of node where credit falls, found with node's sampler (which is built
+	** if needed). Returns CHILD_NIL if that fails; babble() walks the children instead.
+	*/
+STATIC ChildIndex sampler_pick(TREE *node, UsageCnt credit)
+{
+    struct sampler *sp;
+    ChildIndex cidx, lo, hi, mid;
+    UsageCnt *sum, tot;
+
+    sp = &sampler_cache.slot[ SAMPLER_HASH(node) ];
+	/* The first pick from a node only claims the slot; the second one builds */
+    if (sp->node != node) {
+	if (sp->node) sampler_drop(sp->node);
+	sp->node = node;
+	return CHILD_NIL;
+	}
+    if (!sp->sum || sp->branch != node->branch) {
+	free(sp->sum);
+	sampler_cache.bytes -= sp->branch * sizeof *sum;
+	sp->sum = NULL;
+	sp->branch = 0;
+	sum = malloc(node->branch * sizeof *sum);
+	if (!sum) return CHILD_NIL;
+	for (tot = 0, cidx = 0; cidx < node->branch; cidx++) {
+		tot += NODE_VALUE(CHILD_PTR(node, cidx));
+		sum[cidx] = tot;
+		}
+	sp->branch = node->branch;
+	sp->sum = sum;
+	sampler_cache.nbuild += 1;
+	sampler_cache.bytes += sp->branch * sizeof *sum;
+	}
+	/* childsum is off: let the walk wrap around, as it always did */
+    if (credit >= sp->sum[sp->branch-1]) return CHILD_NIL;
+
+    for (lo = 0, hi = sp->branch-1; lo < hi; ) {
+	mid = (lo + hi) / 2;
+	if (credit < sp->sum[mid]) hi = mid;
+	else lo = mid + 1;
+	}
+    return lo;
+}
+
+	/* node is about to change (or go away): forget its sampler */
+STATIC void sampler_drop(TREE *node)
+{
+    struct sampler *sp;
+
+    sp = &sampler_cache.slot[ SAMPLER_HASH(node) ];
+    if (sp->node != node) return;
+    if (sp->sum) sampler_cache.ndrop += 1;
+    free(sp->sum);
+    sampler_cache.bytes -= sp->branch * sizeof *sp->sum;
+    sp->node = NULL;
+    sp->branch = 0;
+    sp->sum = NULL;
+}
+
+	/* Forget all samplers (the nodes are being moved) */
+STATIC void sampler_flush(void)
+{
+    unsigned idx;
+
+    for (idx = 0; idx < SAMPLER_SLOTS; idx++) {
+	if (sampler_cache.slot[idx].node) sampler_drop(sampler_cache.slot[idx].node);
+	}
+}
+#endif /* WANT_SAMPLERS */
+
+#if WANT_FROZEN
+	/* The number of bits needed for val */
+STATIC unsigned bit_width(unsigned long long val)
+{
+    unsigned width;
+
+    for (width = 0; val; val >>= 1) width++;
+    return width;
+}
+
+#if !(defined(__GNUC__) && defined(__POPCNT__))
+STATIC unsigned popcount64(unsigned long long word)
+{
+    word = word - ((word >> 1) & 0x5555555555555555ull);
+    word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+    word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (word * 0x0101010101010101ull) >> 56;
+}
+#endif
+
+	/* The position of set bit number rem (counting from 0) in bits */
+STATIC unsigned select64(unsigned long long bits, unsigned rem)
+{
+    unsigned pos = 0, cnt;
+
+    cnt = POPCOUNT64(bits & 0xffffffffull);
+    if (rem >= cnt) { rem -= cnt; bits >>= 32; pos += 32; }
+    cnt = POPCOUNT64(bits & 0xffff);
+    if (rem >= cnt) { rem -= cnt; bits >>= 16; pos += 16; }
+    cnt = POPCOUNT64(bits & 0xff);
+    if (rem >= cnt) { rem -= cnt; bits >>= 8; pos += 8; }
+    while (rem--) bits &= bits - 1;
+    return pos + CTZ64(bits);
+}
+
+	/* The width bits at bit position pos (width <= 32) */
+STATIC unsigned bits_get(unsigned long long *bits, unsigned long long pos, unsigned width)
+{
+    unsigned long long val;
+    unsigned off;
+
+    if (!width) return 0;
+    off = pos % 64;
+    val = bits[pos / 64] >> off;
+    if (off + width > 64) val |= bits[pos / 64 + 1] << (64 - off);
+    return val & ((1ull << width) - 1);
+}
+
+	/* (the bits must still be zero) */
+STATIC void bits_put(unsigned long long *bits, unsigned long long pos, unsigned width, unsigned val)
+{
+    unsigned off;
+
+    if (!width) return;
+    off = pos % 64;
+    bits[pos / 64] |= (unsigned long long) val << off;
+    if (off + width > 64) bits[pos / 64 + 1] |= (unsigned long long) val >> (64 - off);
+}
+
+	/* The position of 0 number idx (counting from 0) in the LOUDS */
+STATIC unsigned long louds_select0(unsigned long idx)
+{
+    unsigned long sample, pos, end, lo, hi, mid, word;
+    unsigned long long bits;
+    unsigned rem, cnt;
+
+    sample = idx / LOUDS_SAMPLE;
+    pos = frozen_brain.select0[sample];
+    rem = idx % LOUDS_SAMPLE;
+    if (!rem) return pos;
+    end = (sample+1 < frozen_brain.nsample) ? frozen_brain.select0[sample+1] : frozen_brain.nbit;
+    if (end - pos <= 64 * LOUDS_BLOCK) {
+		/* scan from the sample, which is 0 number 0 of this stretch */
+	word = pos / 64;
+	bits = ~frozen_brain.louds[word] & (~0ull << (pos % 64));
 	}
+    else	{
+		/* a big node in between: the last block with at most idx 0s before it */
+	for (lo = pos / (64 * LOUDS_BLOCK), hi = end / (64 * LOUDS_BLOCK); lo < hi; ) {
+		mid = (lo + hi + 1) / 2;
+		if (frozen_brain.rank0[mid] <= idx) lo = mid;
+		else hi = mid - 1;
+		}
+	rem = idx - frozen_brain.rank0[lo];
+	word = lo * LOUDS_BLOCK;
+	bits = ~frozen_brain.louds[word];
+	}
+    for (;; bits = ~frozen_brain.louds[++word]) {
+	cnt = POPCOUNT64(bits);
+	if (rem < cnt) break;
+	rem -= cnt;
+	}
+    return word * 64 + select64(bits, rem);
+}
+
+	/* The position of the first 0 at or after pos, which is 0 number idx.
+	** Nearly always in the same word; for big nodes louds_select0() is faster. */
+STATIC unsigned long louds_next0(unsigned long pos, unsigned long idx)
+{
+    unsigned long long bits;
+
+    bits = ~frozen_brain.louds[pos / 64] >> (pos % 64);
+    if (bits) return pos + CTZ64(bits);
+    bits = ~frozen_brain.louds[pos / 64 + 1];
+    if (bits) return (pos / 64 + 1) * 64 + CTZ64(bits);
+    return louds_select0(idx);
+}
 
-for (slot = 0; slot < indent; slot++) {
-	fputc(' ', fp);
-	}
+STATIC unsigned frozen_level(unsigned long num)
+{
+    unsigned lnum;
 
-fprintf(fp, "Va=%u Su=%u St=%u Br=%u/%u Sym=%u [%u,%u] '%*.*s'\n"
-	, tree->thevalue
-	, tree->childsum
-	, tree->stamp
-	, tree->branch, tree->msize , tree->symbol
-	, valuesum, nnode
-	, (int) str.length , (int) str.length , str.word
-	);
+    for (lnum = 0; num >= frozen_brain.lstart[lnum+1]; lnum++) {;}
+    return lnum;
+}
 
-if (! tree->branch) return;
-for (slot = 0; slot < tree->branch; slot++) {
-	dump_model_recursive(fp, tree->children[slot].ptr , dict, indent+1);
-	}
+STATIC WordNum frozen_symbol(unsigned long num)
+{
+    struct frozenlevel *lev;
+    unsigned lnum;
 
-return;
+    lnum = frozen_level(num);
+    lev = &frozen_brain.level[lnum];
+    return FROZEN_SYM(lev, num - frozen_brain.lstart[lnum]);
 }
 
-/* Delete a symbol from a node.
-** The node's statistics are updated (but NOT it's parent's summary statistics!!)
-** The node is compacted by shifting the highest element into the vacated slot.
-** The node's children-array is NOT (yet) reallocated.
-*/
-STATIC void del_symbol_do_free(TREE *tree, WordNum symbol)
+STATIC UsageCnt frozen_cum(unsigned long num)
 {
-    ChildIndex *ip, this,top;
-    TREE *child = NULL;
+    struct frozenlevel *lev;
+    unsigned lnum;
 
-    /*
-     *		Search for the symbol in the subtree of the tree node.
-     */
-    ip = node_hnd(tree, symbol);
-    if (!ip || *ip == CHILD_NIL) {
-	warn("Del_symbol_do_free", "Symbol %u not found\n", symbol);
-	return ;
-	}
-	/* cut the node out of the hash chain; save the child. */
-    this = *ip;
-    *ip = tree->children[this].link;
-    tree->children[this].link = CHILD_NIL;
-    child = tree->children[this].ptr ;
+    lnum = frozen_level(num);
+    lev = &frozen_brain.level[lnum];
+    return FROZEN_CUM(lev, num - frozen_brain.lstart[lnum]);
+}
 
-    /*
-     *		Decrement the symbol counts
-     *		Avoid wrapping.
-     */
-    if (!tree->childsum) {
-	warn("del_symbol_do_free", "Usage already zero\n");
-    }
-    if (tree->childsum < child->thevalue) {
-	warn("del_symbol_do_free", "Usage (%u -= %u) would drop below zero\n", tree->childsum, child->thevalue );
-	child->thevalue = tree->childsum;
-    }
-    tree->childsum -= child->thevalue;
+	/* Fill in view to describe node num, whose count is value */
+STATIC TREE *frozen_fill(TREE *view, unsigned long num, UsageCnt value)
+{
+    struct frozenlevel *lev;
+    unsigned long start, end, idx;
+    unsigned lnum;
 
-    /* FIXME: we should also decrement the refcounts for the corresponding dict-entry.
-    ** (but that would require access to the model->dict, and we should avoid the risk
-    ** of creating stale pointers in model->context[order]
-    */
-    if (!tree->branch) {
-	warn("del_symbol_do_free", "Branching already zero");
-	goto kill;
-    }
-    top = --tree->branch;
-    memstats.symdel += 1;
-    if ( !top || top == this) {;}
-    else {
-	/* unlink top */
-	ip = node_hnd(tree, tree->children[top].ptr->symbol);
-	*ip = tree->children[top].link;
-	tree->children[top].link = CHILD_NIL;
-	/* now swap this and top */
-	tree->children[this].ptr = tree->children[top].ptr;
-	tree->children[top].ptr = NULL;
-	
-	/* relink into the hash chain */
-	ip = node_hnd(tree, tree->children[this].ptr->symbol);
-	*ip = this;
-	}
+    lnum = frozen_level(num);
+    lev = &frozen_brain.level[lnum];
+    idx = num - frozen_brain.lstart[lnum];
+	/* node num's 1s end at 0 number num */
+    start = num ? louds_select0(num-1) + 1 : 0;
+    end = louds_next0(start, num);
 
-	/* now this child needs to be abolished ... */
-kill:
-    free_tree_recursively(child);
-    memstats.treedel += 1;
-    /* fprintf(stderr, "Freed_tree() node_count now=%u treedel = %u\n",  memstats.node_cnt, memstats.treedel ); */
-    if (!tree->branch || tree->msize - tree->branch >= sqrt( tree->branch)) {
-#if (WANT_DUMP_ALZHEIMER_PROGRESS >= 2)
-	status("Tree(%u/%u) will be shrunk: %u/%u\n"
-		, tree->thevalue, tree->childsum, tree->branch, tree->msize);
+    view->symbol = FROZEN_SYM(lev, idx);
+    NODE_SET_VALUE(view, value);
+    NODE_SET_STAMP(view, frozen_brain.stamp_lo + FROZEN_STAMP(lev, idx));
+    NODE_SET_MSIZE(view, CHILD_FROZEN);
+    view->branch = end - start;
+    view->u.fnum = 2 + start - num;
+    NODE_SET_CHILDSUM(view, view->branch ? frozen_cum(view->u.fnum + view->branch - 1) : 0);
+#if WANT_SUFFIX_LINKS
+    view->suffix = NULL;
 #endif
-		resize_tree(tree, tree->branch);
+    return view;
+}
+
+	/* find_symbol_view() for a frozen node: a binary search over its children */
+STATIC TREE *frozen_find(TREE *node, WordNum symbol, TREE *view)
+{
+    struct frozenlevel *lev;
+    unsigned long first, lo, hi, mid;
+    unsigned lnum;
+    WordNum sym;
+    UsageCnt value;
+
+    if (!node->branch) return NULL;
+    lnum = frozen_level(node->u.fnum);
+    lev = &frozen_brain.level[lnum];
+    first = node->u.fnum - frozen_brain.lstart[lnum];
+    if (lnum == 1) {
+	/* a root: the biggest nodes, and the most frequently searched */
+	mid = node->u.fnum == frozen_brain.root[0].u.fnum ? 0 : 1;
+	if (symbol >= frozen_brain.nrootkid || !frozen_brain.rootkid[mid][symbol]) return NULL;
+	mid = frozen_brain.rootkid[mid][symbol] - 1;
+	value = FROZEN_CUM(lev, mid);
+	if (mid > first) value -= FROZEN_CUM(lev, mid-1);
+	return frozen_fill(view, frozen_brain.lstart[1] + mid, value);
+	}
+    for (lo = first, hi = first + node->branch; lo < hi; ) {
+	mid = (lo + hi) / 2;
+	sym = FROZEN_SYM(lev, mid);
+	if (sym < symbol) lo = mid + 1;
+	else if (sym > symbol) hi = mid;
+	else	{
+		value = FROZEN_CUM(lev, mid);
+		if (mid > first) value -= FROZEN_CUM(lev, mid-1);
+		return frozen_fill(view, frozen_brain.lstart[lnum] + mid, value);
 		}
+	}
+    return NULL;
 }
 
-void free_tree_recursively(TREE *tree)
+	/* babble() for a frozen node: the first child whose running sum exceeds credit */
+STATIC WordNum frozen_pick(TREE *node, UsageCnt credit)
 {
-unsigned index;
-
-if (!tree) return;
+    struct frozenlevel *lev;
+    unsigned long lo, hi, mid;
+    unsigned lnum;
 
-    for (index= tree->branch; index--;	) {
-        free_tree_recursively( tree->children[index].ptr );
-        }
-    free(tree->children);
-    (void) dict_dec_ref(alz_dict, tree->symbol, 1, tree->thevalue);
-    free(tree);
-    memstats.node_cnt -= 1;
-    memstats.free += 1;
+    lnum = frozen_level(node->u.fnum);
+    lev = &frozen_brain.level[lnum];
+    lo = node->u.fnum - frozen_brain.lstart[lnum];
+    for (hi = lo + node->branch - 1; lo < hi; ) {
+	mid = (lo + hi) / 2;
+	if (credit < FROZEN_CUM(lev, mid)) hi = mid;
+	else lo = mid + 1;
+	}
+    return FROZEN_SYM(lev, lo);
 }
 
-/*---------------------------------------------------------------------------*/
-
-STATIC TREE *find_symbol(TREE *node, WordNum symbol)
+	/* Compile both trees from the brain file into frozen_brain, and make
+	** the model's roots refer to it. */
+STATIC int frozen_load(FILE *fp, MODEL *model)
 {
-ChildIndex *ip;
+    struct frozenbuild lev[FROZEN_LEVEL_MAX];
+    unsigned nlevel;
 
-ip = node_hnd(node, symbol);
-if (!ip || *ip == CHILD_NIL) return NULL;
+    frozen_free();
+    memset(lev, 0, sizeof lev);
+    status("Forward\n");
+    if (frozen_read(fp, lev, 0)) goto fail;
+    status("Backward\n");
+    if (frozen_read(fp, lev, 0)) goto fail;
+    for (nlevel = 0; nlevel < FROZEN_LEVEL_MAX && lev[nlevel].mused; nlevel++) {;}
+	/* frozen_build() frees lev[] */
+    if (frozen_build(lev, nlevel)) return -1;
+
+    frozen_brain.stamp_lo = stamp_min;
+#if WANT_COMPACT_NODES
+	/* Like stamp_rebase(); only the views are encoded relative to it */
+    stamp_base = stamp_min;
+    if ((Stamp)(stamp_max - stamp_base) > EPOCH_WIDE - EPOCH_HEADROOM) stamp_base = stamp_max - (EPOCH_WIDE - EPOCH_HEADROOM);
+#endif
+    model->forward = frozen_fill(&frozen_brain.root[0], 0, frozen_cum(0));
+    model->backward = frozen_fill(&frozen_brain.root[1], 1, frozen_cum(1));
+    if (frozen_rootkid()) { frozen_free(); return -1; }
+    memstats.node_cnt = frozen_brain.nnode;
+    status("Frozen %lu nodes in %u levels: %llu bytes\n"
+	, frozen_brain.nnode, frozen_brain.nlevel, frozen_brain.bytes);
+    return 0;
 
-return node->children[*ip].ptr ;
+fail:
+    for (nlevel = 0; nlevel < FROZEN_LEVEL_MAX; nlevel++) free(lev[nlevel].rec);
+    return -1;
 }
 
-/*---------------------------------------------------------------------------*/
-
-STATIC TREE *find_symbol_add(TREE *node, WordNum symbol)
+	/* Read a tree (in depth first order) from the brain file, and append
+	** each node to its level. Each level ends up with the children of the
+	** level above it, in groups, in the order of their parents. */
+STATIC int frozen_read(FILE *fp, struct frozenbuild *lev, unsigned depth)
 {
-ChildIndex *ip;
+    struct nodefile this;
+    struct frozenrec *rec;
+    ChildIndex cidx;
+    unsigned long newsize;
 
-ip = node_hnd(node, symbol);
-if ( !ip || *ip == CHILD_NIL) { /* not found: create one */
-    if (node->branch >= node->msize) {
-        unsigned newsize ;
-        newsize = node->branch+sqrt(1+node->branch);
-        if (resize_tree(node, newsize)) {
-                warn("Find_symbol_add", "resize failed; old=%u new=%u symbol=%u"
-		, node->msize, newsize, symbol );
-		return NULL;
+    if (depth >= FROZEN_LEVEL_MAX) {
+	warn("frozen_read", "Tree is deeper than %u", FROZEN_LEVEL_MAX);
+	return -1;
+	}
+    if (load_node(fp, &this) < 5) {
+	warn("frozen_read", "Truncated brain at level %u", depth);
+	return -1;
+	}
+    if (depth==0 && this.symbol==0) this.symbol=1;
+    if (lev[depth].mused >= lev[depth].msize) {
+	newsize = lev[depth].msize ? lev[depth].msize + lev[depth].msize / 2 : 1024;
+	rec = realloc(lev[depth].rec, newsize * sizeof *rec);
+	if (!rec) {
+		warn("frozen_read", "Unable to allocate level %u: %lu nodes", depth, newsize);
+		return -1;
 		}
-        /* after realloc ip might be stale: need to obtain a new one */
-        ip = node_hnd(node, symbol);
-        if ( !ip) {
-            warn("Find_symbol_add", "Ip was NULL after resize, symbol=%u", symbol );
-            return NULL;
-            }
-        if (*ip != CHILD_NIL) {
-            warn("Find_symbol_add", "*Ip was not CHILD_NIL after resize, symbol=%u, *ip=%u", symbol, (unsigned) *ip );
-            return NULL;
-            }
+	lev[depth].rec = rec;
+	lev[depth].msize = newsize;
 	}
-    *ip = node->branch++;
-    node->children[ *ip ].ptr = node_new(0);
-    node->children[ *ip ].ptr->symbol = symbol;
-    }
+    rec = &lev[depth].rec[ lev[depth].mused++ ];
+    rec->symbol = this.symbol;
+    rec->thevalue = this.thevalue;
+    rec->stamp = this.stamp;
+    rec->branch = this.branch;
+    for (cidx = 0; cidx < this.branch; cidx++) {
+	if (frozen_read(fp, lev, depth+1)) return -1;
+	}
+    return 0;
+}
+
+	/* The roots' children are sorted by symbol: the last one is the largest */
+STATIC int frozen_rootkid(void)
+{
+    unsigned long first, idx;
+    unsigned root;
 
-    return node->children[ *ip ].ptr ;
+    for (root = 0; root < 2; root++) {
+	if (!frozen_brain.root[root].branch) continue;
+	idx = frozen_brain.root[root].u.fnum + frozen_brain.root[root].branch - 1;
+	if (frozen_symbol(idx) >= frozen_brain.nrootkid) frozen_brain.nrootkid = frozen_symbol(idx) + 1;
+	}
+    for (root = 0; root < 2; root++) {
+	frozen_brain.rootkid[root] = calloc(frozen_brain.nrootkid + 1, sizeof *frozen_brain.rootkid[root]);
+	if (!frozen_brain.rootkid[root]) {
+		warn("frozen_rootkid", "Unable to allocate the root index: %u symbols", (unsigned) frozen_brain.nrootkid);
+		return -1;
+		}
+	frozen_brain.bytes += frozen_brain.nrootkid * sizeof *frozen_brain.rootkid[root];
+	first = frozen_brain.root[root].u.fnum;
+	for (idx = first; idx < first + frozen_brain.root[root].branch; idx++) {
+		frozen_brain.rootkid[root][ frozen_symbol(idx) ] = 1 + idx - frozen_brain.lstart[1];
+		}
+	}
+    return 0;
 }
 
-STATIC int resize_tree(TREE *tree, unsigned newsize)
+static struct frozenrec *frozen_sort_rec;
+
+STATIC int frozen_rec_cmp(const void *vl, const void *vr)
 {
-    ChildIndex item,slot;
-    unsigned oldsize;
-    struct treeslot *old;
+    WordNum left, right;
 
-    if (!tree) return -1;
-/* fprintf(stderr, "resize_tree(%u/%u) %u\n", tree->branch,  tree->msize, newsize);*/
-    old = tree->children;
-
-    if (newsize) {
-        tree->children = malloc(newsize * sizeof *tree->children );
-        if (!tree->children) {
-	    error("Resize_tree", "Unable to reallocate subtree.");
-            tree->children = old;
-	    return -1;
-        }
-    }
-    else tree->children = NULL; /* old is freed anyway */
-    oldsize = tree->msize ;
-    tree->msize = newsize;
-    if (tree->children && tree->msize) format_treeslots(tree->children, tree->msize);
+    left = frozen_sort_rec[ *(unsigned long *)vl ].symbol;
+    right = frozen_sort_rec[ *(unsigned long *)vr ].symbol;
+    return (left > right) - (left < right);
+}
 
-#if WANT_DUMP_REHASH_TREE
-	fprintf(stderr, "Old=%p:%u New=%p:%u Tree_resize(%u/%u)\n"
-	, (void*) old, oldsize
-	, (void*) tree->children, newsize
-	, tree->branch,  tree->msize);
-#endif /* WANT_DUMP_REHASH_TREE */
+	/* Number the nodes level by level, with siblings sorted by symbol.
+	** from[] maps a level's numbers to its nodes as read, and is derived from
+	** the level above: every node's group of children, sorted.
+	*/
+STATIC int frozen_build(struct frozenbuild *lev, unsigned nlevel)
+{
+    unsigned long *from = NULL, *next = NULL, *goff = NULL;
+    UsageCnt *cum = NULL, *ncum = NULL, sum, maxcum;
+    unsigned long count, num, idx, kid, pos, bit, word, nword, zeros;
+    unsigned long long nrecbit;
+    struct frozenrec *rec;
+    struct frozenlevel *fl;
+    WordNum maxsym;
+    Stamp maxstamp;
+    ChildIndex cidx;
+    unsigned lnum, block;
+    int rc = -1;
+
+    if (!nlevel || lev[0].mused != 2) {
+	warn("frozen_build", "Expected two roots, got %lu", nlevel ? lev[0].mused : 0);
+	goto done;
+	}
+    frozen_brain.nlevel = nlevel;
+    for (lnum = 0; lnum < nlevel; lnum++) {
+	frozen_brain.lstart[lnum+1] = frozen_brain.lstart[lnum] + lev[lnum].mused;
+	}
+    frozen_brain.nnode = frozen_brain.lstart[nlevel];
+	/* every node but the roots is somebody's child: one 1 each, and one 0 per node */
+    frozen_brain.nbit = 2 * frozen_brain.nnode - 2;
+    if (frozen_brain.nbit >= 0xffffffffu) {
+	warn("frozen_build", "Too many nodes: %lu", frozen_brain.nnode);
+	goto done;
+	}
+	/* (one spare word, for louds_next0()) */
+    nword = frozen_brain.nbit / 64 + 2;
+    frozen_brain.louds = calloc(nword, sizeof *frozen_brain.louds);
+    from = malloc(2 * sizeof *from);
+    cum = malloc(2 * sizeof *cum);
+    if (!frozen_brain.louds || !from || !cum) {
+	warn("frozen_build", "Unable to allocate the LOUDS: %lu bits", frozen_brain.nbit);
+	goto done;
+	}
+    frozen_brain.bytes += nword * sizeof *frozen_brain.louds;
+	/* the roots are not siblings */
+    for (num = 0; num < 2; num++) { from[num] = num; cum[num] = lev[0].rec[num].thevalue; }
+
+    for (bit = 0, lnum = 0; lnum < nlevel; lnum++) {
+	rec = lev[lnum].rec;
+	count = lev[lnum].mused;
+	if (lnum+1 < nlevel) {
+		goff = malloc(count * sizeof *goff);
+		next = malloc(lev[lnum+1].mused * sizeof *next);
+		ncum = malloc(lev[lnum+1].mused * sizeof *ncum);
+		if (!goff || !next || !ncum) {
+			warn("frozen_build", "Unable to allocate level %u: %lu nodes", lnum+1, lev[lnum+1].mused);
+			goto done;
+			}
+			/* where each node's children are in the next level, as read */
+		for (pos = idx = 0; idx < count; idx++) { goff[idx] = pos; pos += rec[idx].branch; }
+		frozen_sort_rec = lev[lnum+1].rec;
+		for (kid = num = 0; num < count; num++, kid += cidx) {
+			idx = from[num];
+			for (cidx = 0; cidx < rec[idx].branch; cidx++) next[kid+cidx] = goff[idx] + cidx;
+			qsort(next + kid, rec[idx].branch, sizeof *next, frozen_rec_cmp);
+			for (sum = 0, cidx = 0; cidx < rec[idx].branch; cidx++) {
+				sum += lev[lnum+1].rec[ next[kid+cidx] ].thevalue;
+				ncum[kid+cidx] = sum;
+				}
+			}
+		free(goff); goff = NULL;
+		}
 
-/* Now rebuild the hash table.
- * The hash-chain pointers have already been initialized to NIL,
- * we only have to copy the children's "payload" verbatim,
- * find the place where to append it in the hash-chain, and put it there.
- *
- * Since we need to rebuild the hash chains anyway, this is a good place to
- * sort the items (in descending order) to make life easier for babble() .
- * We only sort when the node is growing (newsize>oldsize), assuming ordering
- * is more or less fixed for aged nodes. FIXME
- */
-    if (old) {
-	    if (newsize > oldsize && tree->branch > 1) {
-#if ( WANT_DUMP_ALZHEIMER_PROGRESS >= 2 || WANT_DUMP_REHASH_TREE)
-		fprintf(stderr, "Resize:sort(Symbol=%u Cnt=%u) Old=%u New=%u Value=%u Childsum=%u\n"
-		, tree->symbol, tree->branch
-		, oldsize, newsize
-		, tree->thevalue, tree->childsum);
-#endif
-		treeslots_sort(old, tree->branch );
+	maxsym = 0; maxcum = 0; maxstamp = 0;
+	for (num = 0; num < count; num++) {
+		idx = from[num];
+		if (rec[idx].symbol > maxsym) maxsym = rec[idx].symbol;
+		if (cum[num] > maxcum) maxcum = cum[num];
+		if ((Stamp)(rec[idx].stamp - stamp_min) > maxstamp) maxstamp = rec[idx].stamp - stamp_min;
+		}
+	fl = &frozen_brain.level[lnum];
+	fl->wsym = bit_width(maxsym);
+	fl->wcum = bit_width(maxcum);
+	fl->wstamp = bit_width(maxstamp);
+	fl->width = fl->wsym + fl->wcum + fl->wstamp;
+	nrecbit = (unsigned long long) count * fl->width;
+	fl->bits = calloc(nrecbit / 64 + 2, sizeof *fl->bits);
+	if (!fl->bits) {
+		warn("frozen_build", "Unable to allocate level %u: %lu nodes of %u bits", lnum, count, fl->width);
+		goto done;
+		}
+	frozen_brain.bytes += (nrecbit / 64 + 2) * sizeof *fl->bits;
+	for (num = 0; num < count; num++) {
+		idx = from[num];
+		nrecbit = (unsigned long long) num * fl->width;
+		bits_put(fl->bits, nrecbit, fl->wsym, rec[idx].symbol);
+		bits_put(fl->bits, nrecbit + fl->wsym, fl->wcum, cum[num]);
+		bits_put(fl->bits, nrecbit + fl->wsym + fl->wcum, fl->wstamp, rec[idx].stamp - stamp_min);
+		for (cidx = 0; cidx < rec[idx].branch; cidx++, bit++) {
+			frozen_brain.louds[bit / 64] |= 1ull << (bit % 64);
+			}
+		bit++;
 		}
+	free(lev[lnum].rec); lev[lnum].rec = NULL;
+	free(from); from = next; next = NULL;
+	free(cum); cum = ncum; ncum = NULL;
+	}
 
-        for (item =0 ; item < tree->branch; item++) {
-	ChildIndex *ip;
-	slot = old[item].ptr->symbol % tree->msize;
-	for( ip = &tree->children[slot].tabl; *ip != CHILD_NIL; ip = &tree->children[*ip].link ) {
+	/* The rank directory, and the positions of every LOUDS_SAMPLE'th 0 */
+    frozen_brain.nblock = (nword + LOUDS_BLOCK-1) / LOUDS_BLOCK;
+    frozen_brain.nsample = (frozen_brain.nnode + LOUDS_SAMPLE-1) / LOUDS_SAMPLE;
+    frozen_brain.rank0 = malloc(frozen_brain.nblock * sizeof *frozen_brain.rank0);
+    frozen_brain.select0 = malloc(frozen_brain.nsample * sizeof *frozen_brain.select0);
+    if (!frozen_brain.rank0 || !frozen_brain.select0) {
+	warn("frozen_build", "Unable to allocate the LOUDS directory: %lu blocks", frozen_brain.nblock);
+	goto done;
+	}
+    frozen_brain.bytes += frozen_brain.nblock * sizeof *frozen_brain.rank0
+	+ frozen_brain.nsample * sizeof *frozen_brain.select0;
+    for (zeros = 0, block = 0; block < frozen_brain.nblock; block++) {
+	frozen_brain.rank0[block] = zeros;
+	for (word = block * LOUDS_BLOCK; word < (block+1) * LOUDS_BLOCK && word < nword; word++) {
+		zeros += 64 - POPCOUNT64(frozen_brain.louds[word]);
+		}
+	}
+    for (zeros = 0, bit = 0; bit < frozen_brain.nbit; bit++) {
+	if (LOUDS_BIT(bit)) continue;
+	if (zeros % LOUDS_SAMPLE == 0) frozen_brain.select0[zeros / LOUDS_SAMPLE] = bit;
+	zeros++;
+	}
+    rc = 0;
 
-#if (WANT_DUMP_REHASH_TREE >= 2)
-		fprintf(stderr, "%u,", (unsigned) *ip);
-#endif
+done:
+    free(from); free(next); free(goff);
+    free(cum); free(ncum);
+    for (lnum = 0; lnum < FROZEN_LEVEL_MAX; lnum++) { free(lev[lnum].rec); lev[lnum].rec = NULL; }
+    if (rc) frozen_free();
+    return rc;
+}
+
+	/* set_dict_count() for a frozen brain: walk the LOUDS, the children of each node in turn */
+STATIC unsigned long frozen_dict_count(DICT *dict)
+{
+    unsigned long ret = 0, num, kid, bit;
+    UsageCnt prev, cum;
+
+    for (num = 0; num < 2; num++) ret += dict_inc_ref(dict, frozen_symbol(num), 1, frozen_cum(num));
+    for (bit = 0, kid = 2, num = 0; num < frozen_brain.nnode; num++, bit++) {
+	for (prev = 0; LOUDS_BIT(bit); bit++, kid++) {
+		cum = frozen_cum(kid);
+		ret += dict_inc_ref(dict, frozen_symbol(kid), 1, cum - prev);
+		prev = cum;
 		}
-#if (WANT_DUMP_REHASH_TREE >= 2)
-		fprintf(stderr, "Placing Item=%u Hash=%5u(%8x) Slot=%4u TargetSlot=%u (previous %u)\n"
-		, (unsigned) item , (unsigned) old[item].ptr->symbol, (unsigned) old[item].ptr->symbol, (unsigned) slot
-		, (unsigned) ((char*) ip - (char*) &tree->children[0].tabl) / sizeof tree->children[0]
-		, (unsigned) *ip );
-#endif
-	*ip = item;
-	tree->children[item].ptr = old[item].ptr;
 	}
-    free (old);
-    }
-    return 0; /* success */
+    return ret;
 }
 
-STATIC void format_treeslots(struct treeslot *slots , unsigned size)
+STATIC void frozen_free(void)
 {
-    unsigned idx;
+    unsigned lnum;
 
-    for (idx = 0; idx < size; idx++) {
-	slots[idx].tabl = CHILD_NIL;
-	slots[idx].link = CHILD_NIL;
-	slots[idx].ptr = NULL;
+    for (lnum = 0; lnum < frozen_brain.nlevel; lnum++) free(frozen_brain.level[lnum].bits);
+    free(frozen_brain.louds);
+    free(frozen_brain.rank0);
+    free(frozen_brain.select0);
+    free(frozen_brain.rootkid[0]);
+    free(frozen_brain.rootkid[1]);
+#if WANT_COMPACT_NODES
+    node_wide_del(&frozen_brain.root[0]);
+    node_wide_del(&frozen_brain.root[1]);
+#endif
+    memstats.node_cnt -= frozen_brain.nnode;
+    memset(&frozen_brain, 0, sizeof frozen_brain);
+}
+#endif /* WANT_FROZEN */
+
+/*
+** Find the bucket where 'symbol' lives. (or should live)
+** Returns CHILD_NIL if the node has no child table.
+**
+** Profiling shows that node_hnd() is the biggest CPU consumer
+** (unless Alzheimer kicks in ;-)
+** Linear probing over the contiguous hsym[] array: no division, and no
+** dereferencing of child pointers. The table is never full, so the probe
+** always ends at the symbol or at an empty bucket.
+*/
+STATIC ChildIndex node_hnd(TREE *node, WordNum symbol)
+{
+WordNum *hsym;
+unsigned msize, mask, slot;
+
+if (NODE_IS_INLINE(node)) return CHILD_NIL;
+
+msize = NODE_MSIZE(node);
+hsym = (WordNum *) (node->u.children + msize);
+mask = msize - 1;
+slot = CHILD_HASH(symbol) & mask;
+for ( ; 1; slot = (slot+1) & mask) {
+	if (hsym[slot] == symbol) return slot;
+	if (hsym[slot] == WORD_NIL) return slot;
 	}
 }
 
+/*
+** Remove the entry at 'bucket' from the hash table.
+** Entries further down the probe sequence are shifted back into the hole,
+** (unless that would move them before their home bucket) so no tombstones are needed.
+*/
+STATIC void node_unhash(TREE *node, ChildIndex bucket)
+{
+WordNum *hsym;
+ChildIndex *hidx;
+unsigned mask, slot, home;
+
+hsym = CHILD_HSYM(node);
+hidx = CHILD_HIDX(node);
+mask = NODE_MSIZE(node) - 1;
+for (slot = (bucket+1) & mask; hsym[slot] != WORD_NIL; slot = (slot+1) & mask) {
+	home = CHILD_HASH(hsym[slot]) & mask;
+		/* the entry may move iff its home is not cyclically inside (bucket,slot] */
+	if (((slot - home) & mask) < ((slot - bucket) & mask)) continue;
+	hsym[bucket] = hsym[slot];
+	hidx[bucket] = hidx[slot];
+	bucket = slot;
+	}
+hsym[bucket] = WORD_NIL;
+hidx[bucket] = CHILD_NIL;
+}
 
-STATIC int treeslots_cmp(const void *vl, const void *vr)
+/*
+** Find the index of 'symbol' in an inline node (msize == 0)
+*/
+STATIC ChildIndex node_find_inline(TREE *node, WordNum symbol)
 {
-const struct treeslot  *sl=vl;
-const struct treeslot  *sr=vr;
+ChildIndex cidx;
+
+for (cidx = 0; cidx < node->branch; cidx++) {
+	if (symbol == node->u.kids[cidx]->symbol) return cidx;
+	}
+return CHILD_NIL;
+}
+#else /* WANT_OLD_NODES */
 
-if ( !sl->ptr && !sr->ptr) return 0;
-if ( !sl->ptr ) return 1;
-if ( !sr->ptr ) return -1;
+STATIC TREE *find_symbol(TREE *node, WordNum symbol)
+{
+NodeNum *np;
 
-if ( sl->ptr->thevalue < sr->ptr->thevalue ) return 1;
-if ( sl->ptr->thevalue > sr->ptr->thevalue ) return -1;
+if (!node->branch) return NULL;
+np = node_hash_hnd(node, symbol);
+if (!np || *np == NODE_NUM_NIL) return NULL;
 
-if ( sl->ptr->symbol < sr->ptr->symbol ) return -1;
-if ( sl->ptr->symbol > sr->ptr->symbol ) return 1;
-return 0;
+return NODE_PTR(*np);
 }
 
-/* NOTE: quicksort is a bad choice here, since the childnodes are "almost sorted",
- * The sorting does not consume enough CPU to justify a mergesort or insertion sort variant.
- * (when training, qsort ate 10% CPU, most of it in the compare function)
- *
- * This is a "one pass bubblesort":
- * It will /eventually/ get the array sorted.
- * Having the array sorted is not that important: babble() may need only
- * a few steps extra on an almost sorted array.
- * treeslots_cmp(left,right) returns positive if left < right
- * (which is the intended order)
- *
- * NOTE 2013-10-14 we start at the top of the array, since that is
- * where the new entries emerge and the old ones fade away.
- */
+/*---------------------------------------------------------------------------*/
 
-#if 0
-STATIC void treeslots_sort(struct treeslot  *slots , unsigned count)
+#if WANT_PREFETCH
+	/* Start loading the hash chain for find_symbol(node, symbol) (see WANT_PREFETCH) */
+STATIC void node_prefetch(TREE *node, WordNum symbol)
 {
-	qsort(slots, count, sizeof *slots, treeslots_cmp);
+if (!node_tab.hash) return;
+PREFETCH(&node_tab.hash[ node_hash(node->num, symbol) ]);
 }
-#else
+#endif /* WANT_PREFETCH */
 
-STATIC void treeslots_sort(struct treeslot  *slots , unsigned count)
+	/* New children are put in front of the sibling list. */
+STATIC TREE *find_symbol_add(TREE *node, WordNum symbol)
 {
-unsigned idx;
-#if SORT_UP_WOULD_BE_OPTIMAL
-for (idx = 1; idx < count; idx++) {
+NodeNum *np;
+TREE *child;
+
+np = node_hash_hnd(node, symbol);
+if (np && *np != NODE_NUM_NIL) return NODE_PTR(*np);
+
+#if WANT_SHARED_GRAMS
+	/* The forward pass has already counted it: its twin, if new, has count 1 */
+child = node_new_child(node, GRAM_HALF(node) ? gram_twin(node, symbol) : NULL, symbol, 1);
+if (!child) return NULL;
 #else
-for (idx = count; --idx > 0; ) {
+child = node_new(0);
+if (!child) return NULL;
+child->symbol = symbol;
 #endif
-	struct treeslot tmp;
-	if (treeslots_cmp( &slots[idx-1], &slots[idx]) <= 0) continue;
-	tmp = slots[idx];
-	slots[idx] = slots[idx-1];
-	slots[idx-1] = tmp;
+node_adopt(node, child, NULL);
+if (child->parent == NODE_NUM_NIL) { /* adoption failed */
+	node_free(child);
+	memstats.node_cnt -= 1;
+	memstats.free += 1;
+	return NULL;
 	}
+return child;
 }
 
-#endif
-
 /*
-** Find the place where the index to 'symbol' lives. (or should live)
-**
-** Profiling shows that node_hnd() is the biggest CPU consumer
-** (unless Alzheimer kicks in ;-)
-** I don't see a way to speed this thing up, apart from making it static.
+** Multiplicative hash on (parent,symbol); the top hbits bits are used.
+** Unlike in node_hnd() , symbol numbers alone are not good enough here:
+** all the children of one node would share a small range of buckets.
 */
-STATIC ChildIndex *node_hnd(TREE *node, WordNum symbol)
+STATIC unsigned node_hash(NodeNum parent, WordNum symbol)
+{
+return ((parent * 0x9e3779b1u + symbol) * 0x85ebca6bu) >> (32 - node_tab.hbits);
+}
+
+STATIC int node_hash_resize(unsigned newbits)
 {
-ChildIndex *ip;
+NodeNum *new, num;
+TREE *node;
 unsigned slot;
 
-if (!node->msize) return NULL;
+new = malloc ( (sizeof *new) << newbits);
+if (!new) {
+	error("Node_hash_resize", "Unable to allocate hash table: bits=%u", newbits);
+	return -1;
+	}
+for (slot = 0; slot < (1u << newbits); slot++) new[slot] = NODE_NUM_NIL;
+free(node_tab.hash);
+node_tab.hash = new;
+node_tab.hbits = newbits;
+
+	/* Rehash every live node; the roots have no parent, and are not hashed */
+for (num = 0; num < node_tab.mused; num++) {
+	node = NODE_PTR(num);
+	if (node->num == NODE_NUM_NIL || node->parent == NODE_NUM_NIL) continue;
+	slot = node_hash(node->parent, node->symbol);
+	node->link = new[slot];
+	new[slot] = num;
+	}
+return 0;
+}
 
-	/* Symbol-numbers are considered uniform "random" enough
-	** , so don't need hashing */
-slot = symbol % node->msize;
-for (ip = &node->children[ slot ].tabl; *ip != CHILD_NIL; ip = &node->children[ *ip ].link ) {
-#if WANT_MAXIMAL_PARANOIA
-	slot = *ip;
-	if (!node->children[ *ip ].ptr) {
-		warn ( "Node_hnd", "empty child looking for %u\n", symbol);
-		continue;
-		}
-#endif
-	if (symbol == node->children[ *ip ].ptr->symbol) return ip;
+/*
+** Find the place where the number of node's child 'symbol' lives. (or should live)
+*/
+STATIC NodeNum *node_hash_hnd(TREE *node, WordNum symbol)
+{
+NodeNum *np;
+TREE *child;
+
+if (!node_tab.hash) return NULL;
+
+for (np = &node_tab.hash[ node_hash(node->num, symbol) ]; *np != NODE_NUM_NIL; np = &child->link) {
+	child = NODE_PTR(*np);
+	if (child->symbol == symbol && child->parent == node->num) return np;
 	}
-return ip;
+return np;
 }
+#endif /* WANT_OLD_NODES */
 /*---------------------------------------------------------------------------*/
 
 /*
@@ -2112,35 +5764,63 @@ void initialize_context(MODEL *model)
     unsigned int iord;
 
     for (iord = 0; iord < 2+model->order; iord++) model->context[iord] = NULL;
-    if (model->forward) model->forward->stamp = stamp_max;
-    if (model->backward) model->backward->stamp = stamp_max;
+    if (model->forward) NODE_SET_STAMP(model->forward, stamp_max);
+    if (model->backward) NODE_SET_STAMP(model->backward, stamp_max);
 }
 
 STATIC double word_weight(DICT *dict, STRING word, int want_other)
 {
-WordNum *np, symbol;
-
-np = dict_hnd(dict, word);
+WordNum symbol;
 
-if (!np || *np == WORD_NIL) return 0.0;
-symbol = *np;
+symbol = find_word(dict, word);
+if (symbol == WORD_NIL) return 0.0;
 
 return symbol_weight(dict, symbol, want_other);
 }
 
 STATIC double symbol_weight(DICT *dict, WordNum symbol, int want_other)
 {
-STRING alt;
-WordNum *np, altsym;
+#if WANT_WEIGHT_CACHE
+struct wordweight *ww;
 
 if (!dict || symbol >= dict->mused) return 0.0;
-
-if (want_other) {
-	alt = word_dup_othercase(dict->entry[symbol].string);
-	np = dict_hnd(dict, alt);
-	altsym = (np) ? *np : WORD_NIL;
+want_other = !!want_other;
+weight_stats.nask++;
+if (symbol >= dict->wsize && weight_resize(dict)) return symbol_weight_calc(dict, symbol, want_other);
+ww = &dict->weight[symbol];
+if (ww->epoch[want_other] != dict->epoch) {
+	ww->value[want_other] = symbol_weight_calc(dict, symbol, want_other);
+	ww->epoch[want_other] = dict->epoch;
+	weight_stats.ncalc++;
 	}
-else altsym = WORD_NIL;
+return ww->value[want_other];
+#else
+return symbol_weight_calc(dict, symbol, want_other);
+#endif
+}
+
+#if WANT_WEIGHT_CACHE
+	/* Make room in the weight cache for all the dict's (potential) words */
+STATIC int weight_resize(DICT *dict)
+{
+struct wordweight *new;
+
+new = realloc(dict->weight, dict->msize * sizeof *new);
+if (!new) return -1;
+memset(new + dict->wsize, 0, (dict->msize - dict->wsize) * sizeof *new);
+dict->weight = new;
+dict->wsize = dict->msize;
+return 0;
+}
+#endif
+
+STATIC double symbol_weight_calc(DICT *dict, WordNum symbol, int want_other)
+{
+WordNum altsym;
+
+if (!dict || symbol >= dict->mused) return 0.0;
+
+altsym = want_other ? dict_othercase(dict, symbol) : WORD_NIL;
 
 #if (WANT_DUMP_KEYWORD_WEIGHTS & 2)
 fprintf(stderr, "Symbol %u/%u:%u ('%*.*s') %u/%llu\n"
@@ -2181,6 +5861,61 @@ if (altsym==WORD_NIL) {
 	}
 }
 
+	/* The symbols of a word's case variants, or WORD_NIL if the dict does not have them.
+	** With WANT_CASE_FOLD these walk the word's ring, without building or hashing a string.
+	*/
+STATIC WordNum dict_lowercase(DICT *dict, WordNum symbol)
+{
+#if WANT_CASE_FOLD
+return dict->entry[symbol].canon;
+#else
+return find_word(dict, word_dup_lowercase(dict->entry[symbol].string));
+#endif
+}
+
+	/* The spelling of word_dup_initcaps(): the first character uppercase, the rest lowercase */
+STATIC WordNum dict_initcaps(DICT *dict, WordNum symbol)
+{
+#if WANT_CASE_FOLD
+STRING org, alt;
+WordNum other;
+unsigned ii;
+int cha;
+
+org = dict->entry[symbol].string;
+other = symbol;
+do	{
+	alt = dict->entry[other].string;
+	for (ii = 0; ii < org.length; ii++) {
+		cha = org.word[ii];
+		if (!ii) { if (myislower(cha)) cha -= 'a' - 'A'; }
+		else if (myisupper(cha)) cha += 'a' - 'A';
+		if (alt.word[ii] != cha) break;
+		}
+	if (ii == org.length) return other;
+	other = dict->entry[other].fold;
+	} while (other != symbol);
+return WORD_NIL;
+#else
+return find_word(dict, word_dup_initcaps(dict->entry[symbol].string));
+#endif
+}
+
+STATIC WordNum dict_othercase(DICT *dict, WordNum symbol)
+{
+#if WANT_CASE_FOLD
+switch (dict->entry[symbol].string.ztype) {
+case TOKCLASS_INITCAPS:
+case TOKCLASS_CAMEL:
+case TOKCLASS_UPPER: return dict_lowercase(dict, symbol);
+case TOKCLASS_LOWER: return dict_initcaps(dict, symbol);
+default: break;
+	}
+	/* (the other classes are rare: spell it out) */
+#endif
+return find_word(dict, word_dup_othercase(dict->entry[symbol].string));
+}
+
 STATIC STRING word_dup_othercase(STRING org)
 {
 static char zzz[1+WORDLEN_MAX];
@@ -2238,7 +5973,7 @@ unsigned ii;
 new.length = org.length;
 new.ztype = TOKCLASS_INITCAPS;
 
-if (myislower( org.word[0] )) new.word[0] = org.word[0] - ('a' - 'A');
+new.word[0] = myislower( org.word[0] ) ? org.word[0] - ('a' - 'A') : org.word[0];
 for (ii = 1; ii < org.length; ii++) {
 	if (myisupper( org.word[ii] )) new.word[ii] = org.word[ii] + ('a' - 'A');
 	else new.word[ii] = org.word[ii] ;
@@ -2282,13 +6017,32 @@ STATIC void learn_from_input(MODEL *model, struct sentence *words)
 {
     unsigned widx;
     WordNum symbol;
+	/* The symbols of the forward pass, replayed backwards */
+    static WordNum *symbols = NULL;
+    static unsigned msize = 0;
 
     /*
      *		We only learn from inputs which are long enough
      *		We need N+1 words to feed a N-ary model.
      */
     if (words->mused <= model->order) return;
+	/* A frozen brain never learns */
+    if (frozen) return;
+    if (words->mused > msize) {
+	WordNum *new;
+	new = realloc(symbols, words->mused * sizeof *symbols);
+	if (!new) {
+		error("learn_from_input", "Unable to allocate symbol array: %u", words->mused);
+		return;
+		}
+	symbols = new;
+	msize = words->mused;
+	}
     stamp_max++;
+#if WANT_COMPACT_NODES
+	/* a sentence adds at most a few epochs; keep them inside the range */
+    if ((Stamp)(stamp_max - stamp_base) > EPOCH_WIDE - EPOCH_HEADROOM/2) stamp_rebase(model);
+#endif
 
 #if ALZHEIMER_FACTOR
     { unsigned val;
@@ -2310,7 +6064,8 @@ STATIC void learn_from_input(MODEL *model, struct sentence *words)
 	 *		Add the symbol to the model's dictionary if necessary, and then
 	 *		update the forward model accordingly.
 	 */
-	symbol = add_word_dodup(model->dict, words->entry[widx].string );
+	symbol = add_word_hashed(model->dict, words->entry[widx].string, words->entry[widx].hash );
+	symbols[widx] = symbol;
 	update_model(model, symbol);
         /* if (symbol <= 1 || !myisalnum(words->entry[widx].string.word[0])) stamp_max++; */
         if (widx % 64 == 63)  stamp_max++;
@@ -2328,11 +6083,10 @@ STATIC void learn_from_input(MODEL *model, struct sentence *words)
     model->context[0] = model->backward;
     for(widx = words->mused; widx-- > 0; ) {
 	/*
-	 *		Find the symbol in the model's dictionary, and then update
-	 *		the backward model accordingly.
+	 *		Reuse the symbol from the forward pass (no second dictionary lookup),
+	 *		and update the backward model accordingly.
 	 */
-	symbol = find_word(model->dict, words->entry[widx].string );
-	update_model(model, symbol);
+	update_model(model, symbols[widx]);
     }
     /*
      *		Add the sentence-terminating symbol. (for the beginning of the sentence)
@@ -2379,6 +6133,10 @@ STATIC void train(MODEL *model, char *filename)
     }
 
     fclose(fp);
+#if WANT_PATH_COMPRESSION
+    tree_compress(model->forward);
+    tree_compress(model->backward);
+#endif
 }
 
 /*---------------------------------------------------------------------------*/
@@ -2479,9 +6237,16 @@ STATIC void save_model(char *modelname, MODEL *model)
 	status ("Not dirty; not written" );
         goto skip;
         }
+    if (frozen) {
+	status ("Frozen; not written" );
+        goto skip;
+        }
     filename = realloc(filename, strlen(glob_directory)+strlen(SEP)+12);
     if (!filename) error("save_model","Unable to allocate filename");
 
+#if WANT_DICT_GC
+    (void) model_compact(model, DICT_GC_PERCENT);
+#endif
     show_dict(model->dict);
     if (!filename) return;
 
@@ -2520,18 +6285,38 @@ skip:
 STATIC unsigned save_tree(FILE *fp, TREE *node)
 {
     static int level = 0;
-    unsigned int ikid;
+    ChildIndex ikid;
     unsigned count = 1;
+    UsageCnt childsum, thevalue;
+    Stamp stamp;
 
+    childsum = NODE_CHILDSUM(node);
+    thevalue = NODE_VALUE(node);
+    stamp = NODE_STAMP(node);
     fwrite(&node->symbol, sizeof node->symbol, 1, fp);
-    fwrite(&node->childsum, sizeof node->childsum, 1, fp);
-    fwrite(&node->thevalue, sizeof node->thevalue, 1, fp);
-    fwrite(&node->stamp, sizeof node->stamp, 1, fp);
+    fwrite(&childsum, sizeof childsum, 1, fp);
+    fwrite(&thevalue, sizeof thevalue, 1, fp);
+    fwrite(&stamp, sizeof stamp, 1, fp);
     fwrite(&node->branch, sizeof node->branch, 1, fp);
     memstats.node_cnt++;
-    for(ikid = 0; ikid < node->branch; ikid++) {
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(node)) {
+	Count one = 1, more;
+	for (ikid = 0; ikid < RUN_LEN(node); ikid++) {
+		more = (ikid+1 < RUN_LEN(node)) ? 1 : 0;
+		fwrite(&RUN_SYM(node, ikid), sizeof node->symbol, 1, fp);
+		fwrite(&more, sizeof childsum, 1, fp);
+		fwrite(&one, sizeof thevalue, 1, fp);
+		fwrite(&RUN_STAMP(node), sizeof stamp, 1, fp);
+		fwrite(&more, sizeof node->branch, 1, fp);
+		}
+	memstats.node_cnt += RUN_LEN(node);
+	return count + RUN_LEN(node);
+	}
+#endif
+    for(ikid = CHILD_FIRST(node); ikid != CHILD_NIL; ikid = CHILD_NEXT(node, ikid)) {
 	level++;
-	count += save_tree(fp, node->children[ikid].ptr );
+	count += save_tree(fp, CHILD_PTR(node, ikid) );
 	level--;
     }
     return count;
@@ -2539,77 +6324,120 @@ STATIC unsigned save_tree(FILE *fp, TREE *node)
 
 /*---------------------------------------------------------------------------*/
 
-/*
- *		Function:	Load_Tree
- *
- *		Purpose:		Load a tree structure from the specified file.
- */
-STATIC TREE * load_tree(FILE *fp)
+	/* Read one node, and keep track of the stamps. Returns the number of fields read (5) */
+STATIC int load_node(FILE *fp, struct nodefile *this)
 {
-    static int level = 0;
-    unsigned int cidx;
-    unsigned int symbol;
-    unsigned long long int childsum;
-    ChildIndex *ip;
     size_t kuttje;
-    TREE this, *ptr;
 
-    kuttje = fread(&this.symbol, sizeof this.symbol, 1, fp);
-    if (level==0 && this.symbol==0) this.symbol=1;
-    kuttje += fread(&this.childsum, sizeof this.childsum, 1, fp);
-    kuttje += fread(&this.thevalue, sizeof this.thevalue, 1, fp);
-    kuttje += fread(&this.stamp, sizeof this.stamp, 1, fp);
+    kuttje = fread(&this->symbol, sizeof this->symbol, 1, fp);
+    kuttje += fread(&this->childsum, sizeof this->childsum, 1, fp);
+    kuttje += fread(&this->thevalue, sizeof this->thevalue, 1, fp);
+    kuttje += fread(&this->stamp, sizeof this->stamp, 1, fp);
 #if 0
-    if ( this.stamp > stamp_max) stamp_max = this.stamp;
-    else if ( this.stamp < stamp_min) stamp_min = this.stamp;
+    if ( this->stamp > stamp_max) stamp_max = this->stamp;
+    else if ( this->stamp < stamp_min) stamp_min = this->stamp;
 #else
 	/* We allow the timestamp to fold around at 0xffffffff
 	** -->> 0x00000001 will be *above* 0xffffffff ...
 	** Current timestamp is 2386300 (2012-01-31) so this will probably never happen.
 	*/
-    if (stamp_min == stamp_max) { stamp_min = this.stamp; stamp_max = 1+ this.stamp;}
+    if (stamp_min == stamp_max) { stamp_min = this->stamp; stamp_max = 1+ this->stamp;
+#if WANT_COMPACT_NODES
+	/* This is the root's stamp, which is recent. stamp_rebase() fixes the base after loading. */
+	stamp_base = this->stamp - (EPOCH_WIDE - EPOCH_HEADROOM);
+#endif
+	}
     else { int rc;
-    rc = check_interval (stamp_min, stamp_max, this.stamp);
+    rc = check_interval (stamp_min, stamp_max, this->stamp);
     switch (rc) {
-        case STAMP_BELOW: stamp_min = this.stamp; break;
-        case STAMP_ABOVE: stamp_max = this.stamp; break;
+        case STAMP_BELOW: stamp_min = this->stamp; break;
+        case STAMP_ABOVE: stamp_max = this->stamp; break;
 	case STAMP_INSIDE: break;
-	default: error("load_tree", "Weird timestamp(%u,%u) +%u :%d", stamp_min, stamp_max, this.stamp, rc);
+	default: error("load_tree", "Weird timestamp(%u,%u) +%u :%d", stamp_min, stamp_max, this->stamp, rc);
 	}
     }
 #endif
-    kuttje += fread(&this.branch, sizeof this.branch, 1, fp);
+    kuttje += fread(&this->branch, sizeof this->branch, 1, fp);
+    return kuttje;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ *		Function:	Load_Tree
+ *
+ *		Purpose:		Load a tree structure from the specified file.
+ */
+STATIC TREE * load_tree(FILE *fp)
+{
+    static int level = 0;
+    unsigned int cidx;
+    unsigned long long int childsum;
+    TREE *ptr, *child, *prev;
+    struct nodefile this;
+#if WANT_SHARED_GRAMS
+	/* The path of ptr: the parent, and the symbols from the root down */
+    static TREE *load_parent = NULL;
+    static WordNum load_path[GRAM_DEPTH_MAX+1];
+    WordNum words[GRAM_DEPTH_MAX];
+    TREE *twin = NULL;
+#endif
+
+    if (load_node(fp, &this) < 5) return NULL;
+    if (level==0 && this.symbol==0) this.symbol=1;
     // if (this.branch == 0) return NULL;
-    if (kuttje < 5) return NULL;
 
-    ptr = node_new( this.branch );
+#if WANT_SHARED_GRAMS
+	/* The parents are not adopted yet: the twin is found via the path, read backwards */
+    if (level <= GRAM_DEPTH_MAX) load_path[level] = this.symbol;
+    if (level && level <= GRAM_DEPTH_MAX && GRAM_HALF(load_parent)) {
+	for (cidx = 0; cidx < (unsigned) level; cidx++) words[cidx] = load_path[level - cidx];
+	twin = gram_find(words, level);
+	}
+    ptr = level ? node_new_child(load_parent, twin, this.symbol, this.thevalue) : node_new_root( this.branch );
+#else
+    ptr = level ? node_new( this.branch ) : node_new_root( this.branch );
+#endif
     if (!ptr) {
 	error("load_tree", "Unable to allocate subtree");
 	return ptr;
     }
     ptr->symbol = this.symbol;
-    ptr->childsum = this.childsum;
-    ptr->thevalue = this.thevalue;
-    ptr->stamp = this.stamp;
-    ptr->branch = this.branch;
-    /* ptr->children  and ptr->msize are set by node_new() */
+    NODE_SET_CHILDSUM(ptr, this.childsum);
+    NODE_SET_VALUE(ptr, this.thevalue);
+#if WANT_SHARED_GRAMS
+	/* A pair keeps the later of the two stamps */
+    if (!GRAM_HALF(ptr) || NODE_TWIN(ptr)->num == NODE_NUM_NIL
+	|| check_interval(NODE_STAMP(ptr), stamp_max, this.stamp) == STAMP_INSIDE)
+#endif
+    NODE_SET_STAMP(ptr, this.stamp);
+    /* ptr->u.children  and ptr->msize are set by node_new() */
+    /* ptr->branch is incremented by node_adopt() */
 
     childsum = 0;
-    for(cidx = 0; cidx < ptr->branch; cidx++) {
+    for(prev = NULL, cidx = 0; cidx < this.branch; cidx++, prev = child) {
 	level++;
-	ptr->children[cidx].ptr = load_tree(fp);
+#if WANT_SHARED_GRAMS
+	load_parent = ptr;
+#endif
+	child = load_tree(fp);
 	level--;
+	if (!child) break;
 
-	if (ptr->children[cidx].ptr ) childsum += ptr->children[cidx].ptr->thevalue;
-	symbol = ptr->children[cidx].ptr ? ptr->children[cidx].ptr->symbol: cidx;
-	ip = node_hnd(ptr, symbol );
-	if (ip) *ip = cidx;
+	childsum += NODE_VALUE(child);
+	node_adopt(ptr, child, prev);
     }
-    if (childsum != ptr->childsum) {
+    if (childsum != NODE_CHILDSUM(ptr)) {
 		fprintf(stderr, "Oldvalue = %llu <- Newvalue= %llu\n"
-		, (unsigned long long) ptr->childsum , (unsigned long long) childsum);
-		ptr->childsum = childsum;
+		, (unsigned long long) NODE_CHILDSUM(ptr) , (unsigned long long) childsum);
+		NODE_SET_CHILDSUM(ptr, childsum);
 		}
+#if WANT_SORTED_CHILDREN
+    node_sort_children(ptr);
+#endif
+#if WANT_PATH_COMPRESSION
+    (void) node_compress(ptr);
+#endif
 return ptr;
 }
 
@@ -2669,6 +6497,10 @@ STATIC int load_model(char *filename, MODEL *model)
 		, filename , cookie,COOKIE);
 	goto fail;
     }
+	/* Drop the empty trees from new_model(): the pool should only hold the loaded ones */
+    free_tree(model->forward);
+    free_tree(model->backward);
+    model->forward = model->backward = NULL;
     memstats.node_cnt = 0;
     memstats.word_cnt = 0;
     kuttje = fread(&model->order, sizeof model->order, 1, fp);
@@ -2676,12 +6508,26 @@ STATIC int load_model(char *filename, MODEL *model)
     if (model->order != glob_order) {
         model->order = glob_order;
         model->context = realloc(  model->context, (2+model->order) *sizeof *model->context);
+#if WANT_PATH_COMPRESSION
+        model->view = realloc(  model->view, (2+model->order) *sizeof *model->view);
+#endif
         status("Set Order to %u\n", (unsigned)model->order);
 	}
+#if WANT_FROZEN
+    if (frozen) {
+	if (frozen_load(fp, model)) error("load_model", "Unable to freeze `%s'", filename);
+	}
+    else
+#endif
+    {
     status("Forward\n");
     model->forward = load_tree(fp);
     status("Backward\n");
     model->backward = load_tree(fp);
+#if WANT_COMPACT_NODES
+    stamp_rebase(model);
+#endif
+    }
     status("Dict\n");
 #if 1
     load_dict(fp, model->dict);
@@ -2689,6 +6535,9 @@ STATIC int load_model(char *filename, MODEL *model)
     read_dict_from_ascii(model->dict, "megahal.dic" );
 #endif
     refcount = set_dict_count(model);
+#if WANT_DICT_MPH
+    if (frozen) dict_mph_open(model->dict);
+#endif
     status("Loaded %lu Nodes, %u Words. Total Refcount= %u Maxnodes=%lu\n"
 	, memstats.node_cnt,memstats.word_cnt, refcount, (unsigned long)ALZHEIMER_NODE_COUNT);
     status( "Stamp Min=%u Max=%u.\n", (unsigned long)stamp_min, (unsigned long)stamp_max);
@@ -2699,7 +6548,7 @@ STATIC int load_model(char *filename, MODEL *model)
     show_dict(model->dict);
 
 #if ALZHEIMER_FACTOR
-    while ( memstats.node_cnt > ALZHEIMER_NODE_COUNT) {
+    while (!frozen && memstats.node_cnt > ALZHEIMER_NODE_COUNT) {
         model_alzheimer(model, ALZHEIMER_NODE_COUNT);
         }
 #endif
@@ -2761,6 +6610,8 @@ STATIC void make_words(char * src, struct sentence * target)
 		&& target->entry[target->mused-1].string.length
 		 && !strchr(".!?", target->entry[target->mused-1].string.word[ target->entry[target->mused-1].string.length-1] )) {
 	target->entry[target->mused-1].string = period;
+	target->entry[target->mused-1].hash = hash_token(period);
+	target->entry[target->mused-1].symbol = WORD_NIL;
     }
 
     return;
@@ -2821,6 +6672,30 @@ void show_config(FILE *fp)
 {
     fprintf(fp, "[Pid=%d]Compiled-in constant settings:\n", getpid() );
     fprintf(fp, "NODE_COUNT=%d\n", NODE_COUNT);
+    fprintf(fp, "WANT_OLD_NODES=%d\n", WANT_OLD_NODES);
+    fprintf(fp, "WANT_SHARED_GRAMS=%d\n", WANT_SHARED_GRAMS);
+    fprintf(fp, "WANT_SUFFIX_LINKS=%d\n", WANT_SUFFIX_LINKS);
+    fprintf(fp, "WANT_PATH_COMPRESSION=%d\n", WANT_PATH_COMPRESSION);
+#if WANT_OLD_NODES
+    fprintf(fp, "WANT_DENSE_ROOT=%d\n", WANT_DENSE_ROOT);
+    fprintf(fp, "WANT_COMPACT_NODES=%d\n", WANT_COMPACT_NODES);
+    fprintf(fp, "WANT_RELAYOUT=%d\n", WANT_RELAYOUT);
+    fprintf(fp, "WANT_HUGE_PAGES=%d hugepages=%d\n", WANT_HUGE_PAGES, hugepages);
+    fprintf(fp, "CHILD_LOAD_PERCENT=%d CHILD_GROW_SHIFT=%d\n", CHILD_LOAD_PERCENT, CHILD_GROW_SHIFT);
+    fprintf(fp, "WANT_SORTED_CHILDREN=%d\n", WANT_SORTED_CHILDREN);
+    fprintf(fp, "WANT_SAMPLERS=%d SAMPLER_FANOUT=%d\n", WANT_SAMPLERS, SAMPLER_FANOUT);
+    fprintf(fp, "WANT_FROZEN=%d frozen=%d\n", WANT_FROZEN, frozen);
+#endif
+    fprintf(fp, "WANT_PREFETCH=%d\n", WANT_PREFETCH);
+    fprintf(fp, "DICT_GROW_PERCENT=%d\n", DICT_GROW_PERCENT);
+    fprintf(fp, "WANT_STRING_ARENA=%d\n", WANT_STRING_ARENA);
+    fprintf(fp, "WANT_FAST_DICT=%d\n", WANT_FAST_DICT);
+    fprintf(fp, "WANT_CASE_FOLD=%d\n", WANT_CASE_FOLD);
+    fprintf(fp, "WANT_WEIGHT_CACHE=%d\n", WANT_WEIGHT_CACHE);
+    fprintf(fp, "WANT_DICT_GC=%d\n", WANT_DICT_GC);
+    fprintf(fp, "WANT_DICT_SORT=%d\n", WANT_DICT_SORT);
+    fprintf(fp, "DICT_SORT_HOT=%d DICT_SORT_PERCENT=%d\n", DICT_SORT_HOT, DICT_SORT_PERCENT);
+    fprintf(fp, "WANT_DICT_MPH=%d\n", WANT_DICT_MPH);
     fprintf(fp, "ALZHEIMER_NODE_COUNT=%d\n", ALZHEIMER_NODE_COUNT);
     fprintf(fp, "MIN_REPLY_SIZE=%d\n", MIN_REPLY_SIZE);
     fprintf(fp, "INTENDED_REPLY_SIZE=%d\n", INTENDED_REPLY_SIZE);
@@ -2957,7 +6832,9 @@ STATIC void make_keywords(MODEL *model, struct sentence *src)
     unsigned int iwrd;
     WordNum symbol;
 
+#if !WANT_CASE_FOLD
     STRING canonword;
+#endif
     WordNum canonsym;
     /* array for retaining the sliding WINDOW[distance] with previous words. */
     WordNum echobox[CROSS_DICT_WORD_DISTANCE] = {0,};
@@ -2990,7 +6867,7 @@ STATIC void make_keywords(MODEL *model, struct sentence *src)
 	 */
 	if (!myisalnum(src->entry[iwrd].string.word[0] )) continue;
 	/* if (word_is_allcaps(words->entry[iwrd].string)) continue;*/
-        symbol = find_word(model->dict, src->entry[iwrd].string );
+        symbol = find_word_hashed(model->dict, src->entry[iwrd].string, src->entry[iwrd].hash );
         if (symbol == WORD_NIL) continue;
         // if (symbol == WORD_ERR) continue;
         // if (symbol == WORD_FIN) continue;
@@ -2998,9 +6875,13 @@ STATIC void make_keywords(MODEL *model, struct sentence *src)
 
 		/* we may or may not like frequent words */
 	/* 20120119:i We use the wordweight of the canonical form */
+#if WANT_CASE_FOLD
+	canonsym = DICT_CANON(model->dict, symbol);
+#else
 	canonword = word_dup_lowercase(model->dict->entry[symbol].string);
 	canonsym = find_word( model->dict, canonword);
         if (canonsym >= model->dict->mused) canonsym = symbol;
+#endif
 	if (symbol_weight(model->dict, canonsym, 0) < STOP_WORD_TRESHOLD) continue;
 
 	for (other = 0; other < echocount; other++ ) {
@@ -3044,7 +6925,7 @@ STATIC struct sentence *one_reply(MODEL *model)
 	/*
 	 *		Append the symbol to the reply sentence.
 	 */
-	add_word_to_sentence(zereply, model->dict->entry[symbol].string );
+	add_symbol_to_sentence(zereply, model->dict, symbol);
 	/*
 	 *		Extend the current context of the model with the current symbol.
 	 */
@@ -3063,7 +6944,7 @@ STATIC struct sentence *one_reply(MODEL *model)
      *		beginning of the string.
      */
     for(widx = MIN(zereply->mused, 1+model->order); widx-- > 0; ) {
-	symbol = find_word(model->dict, zereply->entry[ widx ].string );
+	symbol = sentence_symbol(model->dict, zereply, widx);
 	update_context(model, symbol);
     }
 
@@ -3075,7 +6956,7 @@ STATIC struct sentence *one_reply(MODEL *model)
 	symbol = babble(model, zereply);
 	if (symbol <= WORD_FIN) break;
 
-	add_word_to_sentence(zereply, model->dict->entry[symbol].string );
+	add_symbol_to_sentence(zereply, model->dict, symbol);
 
 	update_context(model, symbol);
     }
@@ -3086,6 +6967,35 @@ STATIC struct sentence *one_reply(MODEL *model)
 
 /*---------------------------------------------------------------------------*/
 
+/*
+** The probability of symbol in the current context, summed over the orders
+** where it was seen. *count is set to the number of those orders.
+*/
+STATIC double context_probability(MODEL *model, WordNum symbol, unsigned *count)
+{
+    unsigned int iord;
+    double probability = 0.0;
+    TREE *node;
+
+    *count = 0;
+#if WANT_PREFETCH
+    for(iord = 0; iord <= model->order; iord++) {
+        if (model->context[iord]) node_prefetch(model->context[iord], symbol);
+        }
+#endif
+    for(iord = 0; iord <= model->order; iord++) {
+        if ( !model->context[iord] ) continue;
+	/* view[0] is free: context[0] is a root, which is never a view */
+        node = FIND_SYMBOL_VIEW(model, model->context[iord], symbol, 0);
+        if (!node) continue;
+        *count += 1;
+	/* too unique: don't count them */
+        if (NODE_VALUE(node) < 1) continue;
+        probability += (0.1+NODE_VALUE(node)) / (0.1 + NODE_CHILDSUM(model->context[iord]));
+        }
+    return probability;
+}
+
 /*
  *		Function:	Evaluate_Reply
  *
@@ -3098,7 +7008,9 @@ STATIC double evaluate_reply(MODEL *model, struct sentence *de_zin)
     WordNum symbol, canonsym;
     double gfrac, kfrac, weight,term,probability, entropy;
     TREE *node=NULL;
+#if !WANT_CASE_FOLD
     STRING canonword;
+#endif
     unsigned tweetsize=0;
 
     if (de_zin->mused == 0) return -100000.0;
@@ -3114,13 +7026,17 @@ STATIC double evaluate_reply(MODEL *model, struct sentence *de_zin)
     for (widx = 0; widx < de_zin->mused; widx++) {
 	tweetsize += 1+de_zin->entry[widx].string.length;
 
-	symbol = find_word(model->dict, de_zin->entry[widx].string );
+	symbol = sentence_symbol(model->dict, de_zin, widx);
 	if (symbol >= model->dict->msize) continue;
 	/* Only crosstab-keywords contribute to the scoring
 	*/
+#if WANT_CASE_FOLD
+	canonsym = DICT_CANON(model->dict, symbol);
+#else
 	canonword = word_dup_lowercase(model->dict->entry[symbol].string);
 	canonsym = find_word( model->dict, canonword);
         if (canonsym >= model->dict->mused) canonsym = symbol;
+#endif
 #if 1
 	kfrac = crosstab_ask(glob_crosstab, canonsym);
 	// if (kfrac < CROSS_TAB_FRAC / (cross_dict_size) ) goto update1;
@@ -3131,20 +7047,8 @@ STATIC double evaluate_reply(MODEL *model, struct sentence *de_zin)
 	else kfrac = 1.0 / de_zin->mused;
 #else
 #endif
-	probability = 0.0;
-        count = 0;
         totcount++;
-        for(iord = 0; iord <= model->order; iord++) {
-            if ( !model->context[iord] ) continue;
-            node = find_symbol(model->context[iord], symbol);
-            if (!node) continue;
-            // if (!count++) kwhit++;
-            count++;
-		/* too unique: don't count them */
-            /* if (node->thevalue < 2) continue; 20131207 */
-            if (node->thevalue < 1) continue; 
-            probability += (0.1+node->thevalue) / (0.1 + model->context[iord]->childsum);
-            }
+        probability = context_probability(model, symbol, &count);
         if (!count) goto update1;
         if (!(probability > 0.0)) goto update1;
 
@@ -3184,7 +7088,7 @@ update1:
 	   node = model->context[iord] ;
            if (node) break;
            }
-	if (node) { PARROT_ADD(node->stamp); }
+	if (node) { PARROT_ADD(NODE_STAMP(node)); }
 #endif /* WANT_PARROT_CHECK */
 	} /* For-loop */
 
@@ -3197,11 +7101,15 @@ fprintf(stderr, "####[%u] =%6.4f\n", widx,(double) entropy
     model->context[0] = model->backward;
 
     for(widx = de_zin->mused; widx-- > 0; ) {
-	symbol = find_word(model->dict, de_zin->entry[widx].string );
+	symbol = sentence_symbol(model->dict, de_zin, widx);
 	if (symbol >= model->dict->msize) continue;
+#if WANT_CASE_FOLD
+	canonsym = DICT_CANON(model->dict, symbol);
+#else
 	canonword = word_dup_lowercase(model->dict->entry[symbol].string);
 	canonsym = find_word( model->dict, canonword);
         if (canonsym >= model->dict->mused) canonsym = symbol;
+#endif
 #if 1
 	kfrac = crosstab_ask(glob_crosstab, canonsym);
 	// if (kfrac < CROSS_TAB_FRAC / (cross_dict_size) ) goto update2;
@@ -3213,19 +7121,8 @@ fprintf(stderr, "####[%u] =%6.4f\n", widx,(double) entropy
 #else
 	kfrac = model->dict->entry[symbol].string.zflag ? 0.1 : 0.01;
 #endif
-        probability = 0.0;
-        count = 0;
         totcount++;
-        for(iord = 0; iord <= model->order; iord++) {
-            if ( !model->context[iord] ) continue;
-            node = find_symbol(model->context[iord], symbol);
-            if (!node) continue;
-            // if (!count++) kwhit++;
-            count++;
-            /* if (node->thevalue < 2) continue; Too unique */
-            if (node->thevalue < 1) continue; /* Too unique */
-            probability += (0.1+node->thevalue) / (0.1 + model->context[iord]->childsum);
-        }
+        probability = context_probability(model, symbol, &count);
 
         if ( !count ) goto update2;
         if (!(probability > 0.0)) goto update2;
@@ -3266,7 +7163,7 @@ update2:
 	    node = model->context[iord] ;
            if (node) break;
            }
-	if (node) PARROT_ADD(node->stamp);
+	if (node) PARROT_ADD(NODE_STAMP(node));
 #endif /* WANT_PARROT_CHECK */
     }
 #if (WANT_DUMP_KEYWORD_WEIGHTS & 1)
@@ -3442,6 +7339,21 @@ STATIC char *make_output(struct sentence *src)
     return output;
 }
 
+/*---------------------------------------------------------------------------*/
+
+	/* The symbol of node's nth child, without changing the tree (node may be a view) */
+STATIC WordNum node_child_symbol(TREE *node, ChildIndex nth)
+{
+    if (nth >= node->branch) return WORD_NIL;
+#if WANT_FROZEN
+    if (NODE_IS_FROZEN(node)) return frozen_symbol(node->u.fnum + nth);
+#endif
+#if WANT_PATH_COMPRESSION
+    if (NODE_IS_RUN(node)) return RUN_SYM(node, 0);
+#endif
+    return node_child_nth(node, nth)->symbol;
+}
+
 /*---------------------------------------------------------------------------*/
 
 /*
@@ -3455,8 +7367,9 @@ STATIC char *make_output(struct sentence *src)
  */
 STATIC WordNum babble(MODEL *model, struct sentence *src)
 {
-    TREE *node;
-    unsigned int oidx,cidx=0;
+    TREE *node, *child;
+    unsigned int oidx;
+    ChildIndex cidx=0;
     unsigned credit;
     WordNum symbol = WORD_ERR;
 
@@ -3473,7 +7386,7 @@ STATIC WordNum babble(MODEL *model, struct sentence *src)
     if (!node ) goto done;
     if (node->branch == 0) goto done;
     if (node->branch == 1) {
-	symbol = node->children[0].ptr->symbol;
+	symbol = node_child_symbol(node, 0);
 	goto done;
 	}
     /*
@@ -3481,20 +7394,43 @@ STATIC WordNum babble(MODEL *model, struct sentence *src)
      *	weighted by ->thevalue
      */
 #if 1
-    credit = urnd( node->childsum );
+    credit = urnd( NODE_CHILDSUM(node) );
 #if 0
-    credit += urnd( node->childsum -credit ); /* 201501314 */
-    fprintf(stderr, "{%u/%u}", credit, node->childsum);
+    credit += urnd( NODE_CHILDSUM(node) -credit ); /* 201501314 */
+    fprintf(stderr, "{%u/%u}", credit, NODE_CHILDSUM(node));
+#endif
+    babble_stats.npick += 1;
+#if WANT_FROZEN
+	/* A binary search over the running sums. (NB: a view has no sampler) */
+    if (NODE_IS_FROZEN(node)) {
+	babble_stats.nsample += 1;
+	symbol = frozen_pick(node, credit);
+	goto done;
+	}
+#endif
+#if WANT_SAMPLERS
+    if (node->branch >= SAMPLER_FANOUT) {
+	cidx = sampler_pick(node, credit);
+	if (cidx != CHILD_NIL) {
+		babble_stats.nsample += 1;
+		symbol = CHILD_PTR(node, cidx)->symbol;
+		goto done;
+		}
+	}
 #endif
-    for (cidx = 0; 1; cidx = (cidx+1) % node->branch ) {
-	if (credit < node->children[cidx].ptr->thevalue) break; /* found it */
-        /* 20120203 if (node->children[cidx].ptr->thevalue == 0) credit--; */
-	credit -= node->children[cidx].ptr->thevalue;
+    for (cidx = CHILD_FIRST(node); 1; ) {
+	child = CHILD_PTR(node, cidx);
+	babble_stats.nstep += 1;
+	if (credit < NODE_VALUE(child)) break; /* found it */
+        /* 20120203 if (child->thevalue == 0) credit--; */
+	credit -= NODE_VALUE(child);
+	cidx = CHILD_NEXT(node, cidx);
+	if (cidx == CHILD_NIL) cidx = CHILD_FIRST(node);
     }
 #else
-    cidx = urnd( node->branch );
+    child = node_child_nth(node, urnd( node->branch ));
 #endif
-    symbol = node->children[cidx].ptr->symbol;
+    symbol = child->symbol;
 
 done:
 #if 0
@@ -3523,7 +7459,7 @@ STATIC WordNum seed(MODEL *model)
 	if (symbol >= model->dict->mused) symbol = crosstab_get(glob_crosstab, urnd( (cross_dict_size/16)) );
 	if (symbol >= model->dict->mused) symbol
 		 = (model->context[0]->branch) 
-		? model->context[0]->children[ urnd(model->context[0]->branch) ].ptr->symbol
+		? node_child_symbol(model->context[0], urnd(model->context[0]->branch))
 		: WORD_NIL;
 	if (symbol >= model->dict->mused) symbol = urnd(model->dict->mused);
 #if 0
@@ -3543,7 +7479,6 @@ STATIC WordNum seed(MODEL *model)
 double start_penalty(MODEL *model, STRING word)
 {
 WordNum symbol, altsym;
-STRING other;
 TREE *node=NULL, *altnode=NULL;
 double penalty =999;
 
@@ -3553,16 +7488,16 @@ symbol = find_word(model->dict, word);
 init_typ_fwd = word.ztype;
 if (/* symbol <= WORD_ERR || */ symbol == WORD_NIL) return penalty;
 init_typ_fwd = model->dict->entry[symbol].string.ztype;
-node = find_symbol(model->forward, symbol);
+	/* The context is not used anymore: its views are free */
+node = FIND_SYMBOL_VIEW(model, model->forward, symbol, 0);
 if (!node) return 100.0;
 
 switch (init_typ_fwd) {
 case TOKCLASS_INITCAPS:
-	other = word_dup_lowercase(model->dict->entry[symbol].string);
-	altsym = find_word(model->dict, other);
+	altsym = dict_lowercase(model->dict, symbol);
 	if (altsym == WORD_NIL) { penalty = 0.0; break; } /* there is no other: This might be a capitalised Name */
 	else if (altsym==symbol) { penalty = 0.0; break; }
-	altnode = find_symbol(model->forward, altsym);
+	altnode = FIND_SYMBOL_VIEW(model, model->forward, altsym, 1);
 	if (!altnode) penalty = /* the other is not present at this level */
 			(model->dict->entry[altsym].stats.valuesum < model->dict->entry[symbol].stats.valuesum) /* assume Capitalised Name */
 			? 0.1
@@ -3571,14 +7506,13 @@ case TOKCLASS_INITCAPS:
 			/ (1.0+model->dict->entry[altsym].stats.valuesum)
 			);
 	// else if (node->thevalue > altnode->thevalue) penalty = 0.1; /* Initcaps is more frequent at the start of a sentence */
-	else penalty = (0.0+node->thevalue) / (1.0+altnode->thevalue) ;
+	else penalty = (0.0+NODE_VALUE(node)) / (1.0+NODE_VALUE(altnode)) ;
 	break;
 case TOKCLASS_LOWER:
 	/* The altsym refers tot the Initcaps version, which @linebegin should always be better than the original 'symbol' */
-	other = word_dup_initcaps(model->dict->entry[symbol].string);
-	altsym = find_word(model->dict, other);
+	altsym = dict_initcaps(model->dict, symbol);
 	if (altsym == WORD_NIL) { penalty = 1.0; break; } /* there is no other: still deprecated as a starting word */
-	altnode = find_symbol(model->forward, altsym);
+	altnode = FIND_SYMBOL_VIEW(model, model->forward, altsym, 1);
 	if (!altnode)  penalty =
 			(model->dict->entry[altsym].stats.valuesum > model->dict->entry[symbol].stats.valuesum) /* Capitalised Name  ???*/
 			? 1.8
@@ -3586,24 +7520,21 @@ case TOKCLASS_LOWER:
 			: ((1.0+model->dict->entry[symbol].stats.valuesum)
 			/ (1.0+model->dict->entry[altsym].stats.valuesum)
 			);
-	else if (altnode->thevalue <= node->thevalue) penalty = 1.6; /* Initcaps should be more frequent @ start of sentence */
-	else penalty = (1.0+altnode->thevalue) / (1.0+node->thevalue) ;
+	else if (NODE_VALUE(altnode) <= NODE_VALUE(node)) penalty = 1.6; /* Initcaps should be more frequent @ start of sentence */
+	else penalty = (1.0+NODE_VALUE(altnode)) / (1.0+NODE_VALUE(node)) ;
 	break;
 case TOKCLASS_UPPER: /* SHOUTING! */
 case TOKCLASS_AFKO:
 	penalty = 3;
-	other = word_dup_initcaps(model->dict->entry[symbol].string);
 	goto misc;
 case TOKCLASS_CAMEL: /* mostly typos */
 	penalty = 4;
-	other = word_dup_initcaps(model->dict->entry[symbol].string);
 	goto misc;
 case TOKCLASS_MISC:	/* Anything, including high ascii */
 	penalty = 3;
-	other = word_dup_initcaps(model->dict->entry[symbol].string);
 misc:	/* The altsym refers tot the Initcaps version 
 	** which should always be better than symbol */
-	altsym = find_word(model->dict, other);
+	altsym = dict_initcaps(model->dict, symbol);
 	if (altsym == WORD_NIL) { penalty /= 2.0; break; } /* there is no other: still deprecated as a starting word */
 	else if (altsym == symbol) { penalty /= 8; break; }
 	// altnode = find_symbol(model->forward, altsym);
@@ -3635,7 +7566,7 @@ if (!model || !model->backward || !model->dict) return -11.11;
 symbol = find_word(model->dict, word);
 if (/* symbol <= WORD_ERR || */ symbol == WORD_NIL) return 111;
 type = model->dict->entry[symbol].string.ztype;
-node = find_symbol(model->backward, symbol);
+node = FIND_SYMBOL_VIEW(model, model->backward, symbol, 0);
 
 
 switch (type) {
@@ -3841,9 +7772,16 @@ void load_personality(MODEL **model)
     close( glob_fd  ); glob_fd = -1;
     sprintf(filename, "%s%smegahal.brn", glob_directory, SEP);
     if ( load_model(filename, *model) ) {
+	if (frozen) {
+		warn("load_personality", "No brain to freeze in `%s': learning instead", glob_directory);
+		frozen = 0;
+		}
 	sprintf(filename, "%s%smegahal.trn", glob_directory, SEP);
 	train(*model, filename);
     }
+#if WANT_RELAYOUT
+    model_relayout(*model);
+#endif
 
 }
 
@@ -3890,6 +7828,67 @@ STATIC void free_string(STRING word)
     word.zflag = 0;
 }
 
+#if WANT_FAST_DICT
+STATIC HashVal hash_word(STRING string)
+{
+return hash_mem(string.word, (size_t) string.length);
+}
+
+STATIC HashVal hash_mem(void *dat, size_t len)
+{
+return hash_mem64(dat, len);
+}
+
+	/* 8 bytes at a time, with a murmur-style multiply and fold, and a final avalanche */
+STATIC unsigned long long hash_mem64(void *dat, size_t len)
+{
+unsigned char *str = (unsigned char*) dat;
+unsigned long long val, word;
+
+val = len * 0x9e3779b97f4a7c15ull;
+for( ; len >= sizeof word; str += sizeof word, len -= sizeof word) {
+	memcpy(&word, str, sizeof word);
+	val = (val ^ word) * 0xff51afd7ed558ccdull;
+	val ^= val >> 32;
+	}
+if (len) {
+		/* (a memcpy() of a variable length would be a library call) */
+	for (word = 0; len--; ) word = (word << 8) | str[len];
+	val = (val ^ word) * 0xff51afd7ed558ccdull;
+	}
+val ^= val >> 33;
+val *= 0xc4ceb9fe1a85ec53ull;
+val ^= val >> 33;
+return val;
+}
+
+STATIC WordHash hash_token(STRING word)
+{
+return hash_mem64(word.word, (size_t) word.length);
+}
+
+STATIC WordNum * dict_hnd_hashed(DICT *dict, STRING word, HashVal hash)
+{
+unsigned slot, mask;
+
+/* As below: there is always room for one more. If the word is not present,
+ * the returned slot is free, and already carries the word's hash.
+ */
+if (dict->mused >= dict->msize && grow_dict(dict)) return NULL;
+
+mask = (1u << dict->hbits) - 1;
+for (slot = hash & mask; dict->index[slot].symbol != WORD_NIL; slot = (slot+1) & mask) {
+	if (dict->index[slot].hash != hash) continue;
+	if (dict->entry[ dict->index[slot].symbol ].string.length != word.length) continue;
+	if (memcmp(dict->entry[ dict->index[slot].symbol ].string.word, word.word, word.length)) continue;
+	return &dict->index[slot].symbol;
+	}
+	/* (a free slot's hash is never looked at) */
+dict->index[slot].hash = hash;
+return &dict->index[slot].symbol;
+}
+
+#else
 STATIC HashVal hash_word(STRING string)
 {
 return hash_mem(string.word, (size_t) string.length);
@@ -3907,10 +7906,15 @@ for(idx=0; idx < len; idx++ )	{
 return val;
 }
 
-STATIC WordNum * dict_hnd (DICT *dict, STRING word)
+STATIC WordHash hash_token(STRING word)
+{
+return hash_word(word);
+}
+
+STATIC WordNum * dict_hnd_hashed(DICT *dict, STRING word, HashVal hash)
 {
 WordNum *np;
-unsigned hash,slot;
+unsigned slot;
 
 /* We always assume that the next operation will be an insert, so there needs to be at least
  * one free spot.
@@ -3919,7 +7923,6 @@ unsigned hash,slot;
  */
 if (dict->mused >= dict->msize && grow_dict(dict)) return NULL;
 
-hash = hash_word(word);
 slot = hash % dict->msize;
 
 for (np = &dict->entry[slot].tabl ; *np != WORD_NIL ; np = &dict->entry[*np].link ) {
@@ -3931,12 +7934,326 @@ for (np = &dict->entry[slot].tabl ; *np != WORD_NIL ; np = &dict->entry[*np].lin
 	}
 return np;
 }
+#endif /* WANT_FAST_DICT */
+
+STATIC WordNum * dict_hnd (DICT *dict, STRING word)
+{
+return dict_hnd_hashed(dict, word, hash_word(word));
+}
+
+#if WANT_FAST_DICT || WANT_CASE_FOLD
+	/* Rebuild one of the dict's indexes, for msize words, at most half full.
+	** The old hashes are reused: no word is rehashed. */
+STATIC int dict_index_resize(DICT *dict, struct dictindex **index, unsigned *bits)
+{
+struct dictindex *old, *new;
+unsigned oldsize, idx, slot, mask, nbit;
+
+for (nbit = 2; (1u << nbit) < 2 * dict->msize; nbit++) {;}
+old = *index;
+oldsize = old ? 1u << *bits : 0;
+new = malloc((1u << nbit) * sizeof *new);
+if (!new) {
+	error("dict_index_resize", "Unable to allocate dict index: %u slots", 1u << nbit);
+	return -1;
+	}
+mask = (1u << nbit) - 1;
+for (idx = 0; idx <= mask; idx++) new[idx].symbol = WORD_NIL;
+for (idx = 0; idx < oldsize; idx++) {
+	if (old[idx].symbol >= dict->mused) continue;
+	for (slot = old[idx].hash & mask; new[slot].symbol != WORD_NIL; slot = (slot+1) & mask) {;}
+	new[slot] = old[idx];
+	}
+free(old);
+*index = new;
+*bits = nbit;
+return 0;
+}
+#endif
+
+#if WANT_DICT_MPH
+	/* The slot for a hash, with a given pilot: mix, and map 32 bits onto [0,msize) */
+STATIC unsigned mph_slot(unsigned long long hash, unsigned pilot, DictSize msize)
+{
+unsigned long long val;
+
+val = (hash ^ (pilot * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull;
+val ^= val >> 32;
+return (unsigned) (((val & 0xffffffffull) * msize) >> 32);
+}
+
+STATIC struct dictmph *dict_mph_new(DictSize msize)
+{
+struct dictmph *mph;
+
+mph = malloc(sizeof *mph);
+if (!mph) return NULL;
+mph->msize = msize;
+mph->nbucket = msize / MPH_BUCKET_LOAD + 1;
+mph->pilot = malloc(mph->nbucket * sizeof *mph->pilot);
+mph->slot = malloc((msize ? msize : 1) * sizeof *mph->slot);
+if (!mph->pilot || !mph->slot) {
+	free(mph->pilot);
+	free(mph->slot);
+	free(mph);
+	return NULL;
+	}
+return mph;
+}
+
+STATIC void dict_mph_free(DICT *dict)
+{
+if (!dict->mph) return;
+free(dict->mph->pilot);
+free(dict->mph->slot);
+free(dict->mph);
+dict->mph = NULL;
+}
+
+	/* Fill mph's slots from its pilots. Fails if two words land in the same slot */
+STATIC int dict_mph_place(DICT *dict, struct dictmph *mph, unsigned long long *hash)
+{
+WordNum symbol;
+unsigned slot;
+
+for (slot = 0; slot < mph->msize; slot++) mph->slot[slot] = WORD_NIL;
+for (symbol = 0; symbol < dict->mused; symbol++) {
+	slot = mph_slot(hash[symbol], mph->pilot[ MPH_BUCKET(hash[symbol], mph->nbucket) ], mph->msize);
+	if (mph->slot[slot] != WORD_NIL) return -1;
+	mph->slot[slot] = symbol;
+	}
+return 0;
+}
+
+	/* Search a pilot for every bucket, the biggest buckets first */
+STATIC int dict_mph_build(DICT *dict, unsigned long long *hash)
+{
+struct dictmph *mph;
+unsigned *start, *order, bucket, idx, pilot, nword, maxsize;
+WordNum *member, symbol;
+unsigned char *taken;
+
+mph = dict_mph_new(dict->mused);
+if (!mph) return -1;
+start = calloc(mph->nbucket + 1, sizeof *start);
+order = malloc(mph->nbucket * sizeof *order);
+member = malloc((dict->mused ? dict->mused : 1) * sizeof *member);
+taken = calloc(dict->mused ? dict->mused : 1, 1);
+if (!start || !order || !member || !taken) goto fail;
+
+	/* the words, grouped by bucket: bucket b has member[start[b] ... start[b+1]-1] */
+for (symbol = 0; symbol < dict->mused; symbol++) start[ MPH_BUCKET(hash[symbol], mph->nbucket) + 1 ]++;
+for (maxsize = bucket = 0; bucket < mph->nbucket; bucket++) {
+	if (start[bucket+1] > maxsize) maxsize = start[bucket+1];
+	start[bucket+1] += start[bucket];
+	}
+	/* (order[] serves as the fill pointers, first) */
+for (bucket = 0; bucket < mph->nbucket; bucket++) order[bucket] = start[bucket];
+for (symbol = 0; symbol < dict->mused; symbol++) {
+	bucket = MPH_BUCKET(hash[symbol], mph->nbucket);
+	member[ order[bucket]++ ] = symbol;
+	}
+
+	/* The buckets by descending size: a counting sort */
+for (idx = 0, nword = maxsize+1; nword-- > 0; ) {
+	for (bucket = 0; bucket < mph->nbucket; bucket++) {
+		if (start[bucket+1] - start[bucket] == nword) order[idx++] = bucket;
+		}
+	}
+
+for (idx = 0; idx < mph->nbucket; idx++) {
+	unsigned ii, jj, slot;
+	bucket = order[idx];
+	for (pilot = 0; pilot < MPH_PILOT_MAX; pilot++) {
+		for (ii = start[bucket]; ii < start[bucket+1]; ii++) {
+			slot = mph_slot(hash[ member[ii] ], pilot, mph->msize);
+			if (taken[slot]) break;
+			taken[slot] = 1;
+			}
+		if (ii == start[bucket+1]) break;
+			/* undo the ones that did fit */
+		for (jj = start[bucket]; jj < ii; jj++) taken[ mph_slot(hash[ member[jj] ], pilot, mph->msize) ] = 0;
+		}
+	if (pilot >= MPH_PILOT_MAX) {
+		warn("dict_mph_build", "No pilot for bucket %u (%u words)", bucket, start[bucket+1] - start[bucket]);
+		goto fail;
+		}
+	mph->pilot[bucket] = pilot;
+	}
+if (dict_mph_place(dict, mph, hash)) goto fail;
+
+free(start); free(order); free(member); free(taken);
+dict->mph = mph;
+return 0;
+
+fail:
+free(start); free(order); free(member); free(taken);
+free(mph->pilot); free(mph->slot); free(mph);
+return -1;
+}
+
+	/* megahal.mph: the cookie, the number of words and of buckets, and the pilots */
+STATIC int dict_mph_load(DICT *dict, char *filename, unsigned long long *hash)
+{
+FILE *fp;
+char cookie[sizeof MPH_COOKIE];
+DictSize msize;
+unsigned nbucket;
+struct dictmph *mph = NULL;
+
+fp = fopen(filename, "rb");
+if (!fp) return -1;
+if (fread(cookie, strlen(MPH_COOKIE), 1, fp) != 1 || memcmp(cookie, MPH_COOKIE, strlen(MPH_COOKIE))) goto fail;
+if (fread(&msize, sizeof msize, 1, fp) != 1 || msize != dict->mused) goto fail;
+if (fread(&nbucket, sizeof nbucket, 1, fp) != 1) goto fail;
+mph = dict_mph_new(msize);
+if (!mph || nbucket != mph->nbucket) goto fail;
+if (fread(mph->pilot, sizeof *mph->pilot, nbucket, fp) != nbucket) goto fail;
+if (dict_mph_place(dict, mph, hash)) goto fail;
+fclose(fp);
+dict->mph = mph;
+return 0;
+
+fail:
+fclose(fp);
+if (mph) { free(mph->pilot); free(mph->slot); free(mph); }
+return -1;
+}
+
+STATIC int dict_mph_save(DICT *dict, char *filename)
+{
+FILE *fp;
+int rc = 0;
+
+if (!dict->mph) return -1;
+fp = fopen(filename, "wb");
+if (!fp) return -1;
+if (fwrite(MPH_COOKIE, strlen(MPH_COOKIE), 1, fp) != 1) rc = -1;
+if (fwrite(&dict->mph->msize, sizeof dict->mph->msize, 1, fp) != 1) rc = -1;
+if (fwrite(&dict->mph->nbucket, sizeof dict->mph->nbucket, 1, fp) != 1) rc = -1;
+if (fwrite(dict->mph->pilot, sizeof *dict->mph->pilot, dict->mph->nbucket, fp) != dict->mph->nbucket) rc = -1;
+if (fclose(fp)) rc = -1;
+return rc;
+}
+
+	/* Load the MPH from megahal.mph, or build it (and write the file) */
+STATIC void dict_mph_open(DICT *dict)
+{
+char *filename;
+unsigned long long *hash;
+WordNum symbol;
+
+if (!dict || !dict->mused) return;
+dict_mph_free(dict);
+hash = malloc(dict->mused * sizeof *hash);
+filename = malloc(strlen(glob_directory) + strlen(SEP) + 12);
+if (!hash || !filename) {
+	free(hash); free(filename);
+	warn("dict_mph_open", "Unable to allocate the hashes: %u words", (unsigned) dict->mused);
+	return;
+	}
+for (symbol = 0; symbol < dict->mused; symbol++) {
+	hash[symbol] = hash_mem64(dict->entry[symbol].string.word, dict->entry[symbol].string.length);
+	}
+sprintf(filename, "%s%smegahal.mph", glob_directory, SEP);
+if (!dict_mph_load(dict, filename, hash)) status("Dictmph: loaded %s\n", filename);
+else if (dict_mph_build(dict, hash)) warn("dict_mph_open", "Unable to build the MPH: %u words", (unsigned) dict->mused);
+else if (dict_mph_save(dict, filename)) warn("dict_mph_open", "Unable to write `%s'", filename);
+else status("Dictmph: built %s\n", filename);
+free(hash);
+free(filename);
+}
+
+STATIC WordNum dict_mph_find(DICT *dict, STRING word)
+{
+return dict_mph_find_hashed(dict, word, hash_mem64(word.word, word.length));
+}
+
+STATIC WordNum dict_mph_find_hashed(DICT *dict, STRING word, unsigned long long hash)
+{
+WordNum symbol;
+
+symbol = dict->mph->slot[ mph_slot(hash, dict->mph->pilot[ MPH_BUCKET(hash, dict->mph->nbucket) ], dict->mph->msize) ];
+if (dict->entry[symbol].string.length != word.length) return WORD_NIL;
+if (memcmp(dict->entry[symbol].string.word, word.word, word.length)) return WORD_NIL;
+return symbol;
+}
+#endif /* WANT_DICT_MPH */
+
+#if WANT_CASE_FOLD
+	/* The hash of word's lowercase form */
+STATIC HashVal hash_fold(STRING word)
+{
+char buff[1+WORDLEN_MAX];
+unsigned ii;
+
+for (ii = 0; ii < word.length; ii++) {
+	buff[ii] = myisupper(word.word[ii]) ? word.word[ii] + ('a' - 'A') : word.word[ii];
+	}
+return hash_mem(buff, word.length);
+}
+
+STATIC int word_fold_equal(STRING one, STRING two)
+{
+unsigned ii;
+int left, right;
+
+if (one.length != two.length) return 0;
+for (ii = 0; ii < one.length; ii++) {
+	left = myisupper(one.word[ii]) ? one.word[ii] + ('a' - 'A') : one.word[ii];
+	right = myisupper(two.word[ii]) ? two.word[ii] + ('a' - 'A') : two.word[ii];
+	if (left != right) return 0;
+	}
+return 1;
+}
+
+	/* Put a new word in the ring of its case variants, and set its canon.
+	** If it is the ring's (only) lowercase word, it is everybody's canon. */
+STATIC void dict_fold_add(DICT *dict, WordNum symbol)
+{
+STRING word;
+HashVal hash;
+unsigned slot, mask, ii;
+WordNum other, lower;
+
+word = dict->entry[symbol].string;
+for (ii = 0; ii < word.length && !myisupper(word.word[ii]); ii++) {;}
+lower = (ii == word.length) ? symbol : WORD_NIL;
+
+hash = hash_fold(word);
+mask = (1u << dict->fbits) - 1;
+for (slot = hash & mask; dict->foldindex[slot].symbol != WORD_NIL; slot = (slot+1) & mask) {
+	if (dict->foldindex[slot].hash != hash) continue;
+	if (word_fold_equal(dict->entry[ dict->foldindex[slot].symbol ].string, word)) break;
+	}
+other = dict->foldindex[slot].symbol;
+if (other == WORD_NIL) {
+	dict->foldindex[slot].hash = hash;
+	dict->foldindex[slot].symbol = symbol;
+	dict->entry[symbol].fold = symbol;
+	dict->entry[symbol].canon = lower;
+	return;
+	}
+
+dict->entry[symbol].fold = dict->entry[other].fold;
+dict->entry[other].fold = symbol;
+if (lower == WORD_NIL) {
+	dict->entry[symbol].canon = dict->entry[other].canon;
+	return;
+	}
+for (other = symbol; ; ) {
+	dict->entry[other].canon = symbol;
+	other = dict->entry[other].fold;
+	if (other == symbol) break;
+	}
+}
+#endif /* WANT_CASE_FOLD */
 
 STATIC int grow_dict(DICT *dict)
 {
     unsigned newsize;
 
-    newsize = dict->mused ? dict->mused + sqrt(1+dict->mused) : DICT_SIZE_INITIAL;
+    newsize = dict->mused ? dict->mused + DICT_SIZE_INITIAL + ((unsigned long) dict->mused * DICT_GROW_PERCENT) / 100 : DICT_SIZE_INITIAL;
     return resize_dict(dict, newsize);
 }
 
@@ -3944,7 +8261,9 @@ STATIC int grow_dict(DICT *dict)
 STATIC int resize_dict(DICT *dict, unsigned newsize)
 {
     struct dictslot *old;
+#if !WANT_FAST_DICT
     WordNum item,slot;
+#endif
 
     old = dict->entry ;
     while (newsize < dict->mused) newsize += 2;
@@ -3956,6 +8275,13 @@ STATIC int resize_dict(DICT *dict, unsigned newsize)
 	}
     dict->msize = newsize;
     format_dictslots(dict->entry, dict->msize);
+    grow_stats.dict_resize += 1;
+    grow_stats.dict_moved += dict->mused;
+#if WANT_FAST_DICT
+    memcpy(dict->entry, old, dict->mused * sizeof *dict->entry);
+    free (old);
+    if (dict_index_resize(dict, &dict->index, &dict->hbits)) return -1;
+#else
 
 	/* When we get here, dict->entry contains the new slots (with empty hashtable)
 	** and *old* contains the old entries (including hashtable)
@@ -3987,8 +8313,16 @@ STATIC int resize_dict(DICT *dict, unsigned newsize)
 		dict->entry[item].stats.nnode = old[item].stats.nnode;
 		dict->entry[item].stats.valuesum = old[item].stats.valuesum;
 		dict->entry[item].string = old[item].string;
+#if WANT_CASE_FOLD
+		dict->entry[item].canon = old[item].canon;
+		dict->entry[item].fold = old[item].fold;
+#endif
 		}
     free (old);
+#endif /* WANT_FAST_DICT */
+#if WANT_CASE_FOLD
+    if (dict_index_resize(dict, &dict->foldindex, &dict->fbits)) return -1;
+#endif
     return 0; /* success */
 }
 
@@ -4032,9 +8366,17 @@ STATIC void sentence_reverse(struct sentence *ptr)
     unsigned bot,top;
     for (bot = 0, top = ptr->mused? ptr->mused-1: 0; bot < top; bot++, top--) {
 	STRING tmp ;
+	WordHash hash;
+	WordNum symbol;
 	tmp = ptr->entry[bot].string;
 	ptr->entry[bot].string = ptr->entry[top].string;
 	ptr->entry[top].string  = tmp;
+	hash = ptr->entry[bot].hash;
+	ptr->entry[bot].hash = ptr->entry[top].hash;
+	ptr->entry[top].hash  = hash;
+	symbol = ptr->entry[bot].symbol;
+	ptr->entry[bot].symbol = ptr->entry[top].symbol;
+	ptr->entry[top].symbol  = symbol;
 	}
 }
 
@@ -4053,6 +8395,7 @@ static unsigned direction = 0;
 int rc;
 
 if (!model || !maxnodecount) return 0;
+if (frozen) return 0;
 if (memstats.node_cnt <= ALZHEIMER_NODE_COUNT) return 0;
 
 alz_dict = model->dict;
@@ -4127,6 +8470,9 @@ for(  totcount = 0; memstats.node_cnt > maxnodecount;	) {
     else density *= 0.8;
 
     stamp_min = limit;
+#if WANT_COMPACT_NODES
+    stamp_rebase(model);
+#endif
 
 #if WANT_DUMP_ALZHEIMER_PROGRESS
     fprintf(stderr, "Model_alzheimer(%u:%s) Count=%6u %u/%u Stamp=[%u,%u] Width=%u Step=%u Dens=%6.4f\n"
@@ -4154,39 +8500,56 @@ return totcount;
 
 STATIC unsigned symbol_alzheimer_recurse(TREE *tree, unsigned lev, Stamp lim)
 {
-unsigned slot,count;
+unsigned count;
+ChildIndex cidx, next;
+#if (WANT_DUMP_ALZHEIMER_PROGRESS >= 3)
+unsigned slot;
+#endif
 WordNum symbol;
 int rc;
 
 if (!tree) return 0;
 alz_stack[lev++] = tree;
+#if WANT_SUFFIX_LINKS
+	/* The link may point into a subtree that is about to be deleted.
+	** Every surviving node of this tree is visited here, so just drop them all. */
+tree->suffix = NULL;
+#endif
 
-rc = check_interval(lim, stamp_max, tree->stamp);
+rc = check_interval(lim, stamp_max, NODE_STAMP(tree));
 if (rc) { /* Too old: outside interval */
 #if (WANT_DUMP_ALZHEIMER_PROGRESS >= 3)
 	for (slot=0; slot< lev; slot++) fputc(' ', alz_file);
-	for (slot=0; slot< lev; slot++) fprintf(alz_file, "[%u:%u]", alz_stack[slot]->symbol, alz_stack[slot]->stamp );
+	for (slot=0; slot< lev; slot++) fprintf(alz_file, "[%u:%u]", alz_stack[slot]->symbol, NODE_STAMP(alz_stack[slot]) );
 	fprintf(alz_file, "symbol_alzheimer_recurse(rc=%d) Node considered too old (stamp=%u symbol=%u childsum=%u count=%u)\n"
-	, rc, tree->stamp, tree->symbol, tree->childsum, tree->thevalue);
+	, rc, NODE_STAMP(tree), tree->symbol, NODE_CHILDSUM(tree), NODE_VALUE(tree));
 #endif
 #if (WANT_DUMP_ALZHEIMER_PROGRESS >= 4)
 	dump_model_recursive(alz_file, tree, alz_dict, lev);
 #endif
 	}
 
+#if WANT_PATH_COMPRESSION
+	/* All of the run has the same stamp: it either survives or goes as a whole */
+if (NODE_IS_RUN(tree)) {
+	if (!check_interval(lim, stamp_max, RUN_STAMP(tree))) return 0;
+	if (node_unrun(tree)) return 0;
+	}
+#endif
+
 /* We should work from top to bottom, because it would require less shuffling */
 count = 0;
-for (slot = tree->branch; slot--> 0;	) {
+for (cidx = CHILD_REAP_FIRST(tree); cidx != CHILD_NIL; cidx = next) {
 	TREE *child;
 
 #if (WANT_DUMP_ALZHEIMER_PROGRESS >= 3)
     fprintf(alz_file, "symbol_alzheimer_recurse(lev=%u lim=%u) Stamp=%u enter this slot=%u\n"
-	, lev, lim, tree->stamp, slot);
+	, lev, lim, NODE_STAMP(tree), cidx);
 #endif
-	if (slot >= tree->branch) continue;
-	child =  tree->children[slot].ptr;
+	next = CHILD_REAP_NEXT(tree, cidx);
+	child = CHILD_PTR(tree, cidx);
 	if (!child) continue;
-	rc = check_interval(lim, stamp_max, child->stamp);
+	rc = check_interval(lim, stamp_max, NODE_STAMP(child));
 	if (!rc) { /* inside interval */
 		count += symbol_alzheimer_recurse(child, lev, lim);
 		continue;
@@ -4198,6 +8561,9 @@ for (slot = tree->branch; slot--> 0;	) {
 		count++;
 		}
 	}
+#if WANT_PATH_COMPRESSION
+(void) node_compress(tree);
+#endif
 return count;
 }
 
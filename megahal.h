@@ -112,6 +112,8 @@ void megahal_setnoprompt (void);
 void megahal_setnowrap (void);
 void megahal_setnobanner (void);
 void megahal_setnoprogress (void);
+void megahal_sethugepages (void);
+void megahal_setfrozen (void);
 
 void megahal_seterrorfile(char *filename);
 void megahal_setstatusfile(char *filename);
@@ -132,6 +134,8 @@ void megahal_dumpmodel(char *path, int flags);
 void megahal_dumptree(char *path, int flags);
 
 void megahal_cleanup(void);
+void megahal_relayout(void);
+void megahal_compact(void);
 void show_config(FILE *fp);
 
 /*===========================================================================*/
@@ -0,0 +1,77 @@
+/*
+** walk_driv.c: microbenchmark for the multi-order context walks.
+**
+** usage: walkbench <directory> [passes] < sentences
+**
+** Loads the brain from <directory>, maps every input line to its symbols,
+** and then times the walk that evaluate_reply() does for each of them:
+** context_probability() and update_context(), forward and backward.
+** Nothing is written back. Build it twice, with -DWANT_PREFETCH=0 and 1,
+** and run both on a brain that is (much) larger than the last level cache.
+*/
+	/* clock_gettime() (the Makefile's CFLAGS ask for plain POSIX) */
+#define _POSIX_C_SOURCE 199309L
+#include "megahal.c"
+
+#define WALK_MAX_LINES (1024*1024)
+
+int main(int argc, char **argv)
+{
+static char line[8192];
+static struct sentence *work;
+WordNum **syms, symbol;
+unsigned *nsym, nline, idx, widx, count, pass, npass;
+unsigned long nwalk = 0;
+double sum = 0.0, secs;
+struct timespec t0, t1;
+
+if (argc < 2) { fprintf(stderr, "usage: %s <directory> [passes] < sentences\n", argv[0]); return 1; }
+npass = (argc > 2) ? atoi(argv[2]) : 1;
+
+megahal_setdirectory(argv[1]);
+megahal_setnobanner();
+megahal_setquiet();
+megahal_setnoprompt();
+megahal_initialize();
+
+syms = malloc(WALK_MAX_LINES * sizeof *syms);
+nsym = malloc(WALK_MAX_LINES * sizeof *nsym);
+work = sentence_new();
+for (nline = 0; nline < WALK_MAX_LINES && fgets(line, sizeof line, stdin); ) {
+	line[strcspn(line, "\n")] = 0;
+	if (!*line) continue;
+	make_words(line, work);
+	syms[nline] = malloc(work->mused * sizeof **syms);
+	for (count = widx = 0; widx < work->mused; widx++) {
+		symbol = find_word(glob_model->dict, work->entry[widx].string);
+		if (symbol >= glob_model->dict->msize) continue;
+		syms[nline][count++] = symbol;
+		}
+	nsym[nline++] = count;
+	}
+
+clock_gettime(CLOCK_MONOTONIC, &t0);
+for (pass = 0; pass < npass; pass++) {
+	for (idx = 0; idx < nline; idx++) {
+		initialize_context(glob_model);
+		glob_model->context[0] = glob_model->forward;
+		for (widx = 0; widx < nsym[idx]; widx++) {
+			sum += context_probability(glob_model, syms[idx][widx], &count);
+			update_context(glob_model, syms[idx][widx]);
+			}
+		initialize_context(glob_model);
+		glob_model->context[0] = glob_model->backward;
+		for (widx = nsym[idx]; widx-- > 0; ) {
+			sum += context_probability(glob_model, syms[idx][widx], &count);
+			update_context(glob_model, syms[idx][widx]);
+			}
+		nwalk += 2 * nsym[idx];
+		}
+	}
+clock_gettime(CLOCK_MONOTONIC, &t1);
+
+secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+printf("WANT_PREFETCH=%d lines=%u steps=%lu time=%.3fs steps/s=%.0f ns/step=%.1f (check=%g)\n"
+	, WANT_PREFETCH, nline, nwalk, secs, nwalk / secs, secs * 1e9 / nwalk, sum);
+return 0;
+}